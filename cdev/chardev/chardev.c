@@ -11,51 +11,185 @@
 #include <linux/device.h>	// デバイスドライバの管理を行う
 #include <linux/init.h>		// カーネルモジュールの初期化, クリーンアップ関連のマクロや関数を提供する
 #include <linux/kernel.h>	// カーネル関連の汎用的なマクロ, 関数を提供する
+#include <linux/mm.h>		// ページ単位のメモリ管理を行う関数を提供する
 #include <linux/module.h>
+#include <linux/moduleparam.h>	// モジュールパラメータを定義するマクロを提供する
 #include <linux/printk.h>
+#include <linux/pipe_fs_i.h>	// パイプバッファの操作を定義する
+#include <linux/slab.h>		// kmalloc, kfreeなどのメモリ確保を行う関数を提供する
+#include <linux/splice.h>	// splice/sendfileでパイプにページを渡す関数を提供する
+#include <linux/topology.h>	// CPUが属するNUMAノードを取得する
 #include <linux/uaccess.h>	// ユーザ空間とのデータのやりとり（コピー）を行う回数を提供する
+#include <linux/uio.h>		// iov_iterを使ったユーザ空間へのコピーを提供する
 #include <linux/version.h>	// カーネルのバージョンを判定するためのマクロを提供する
+#include <linux/vmalloc.h>	// 仮想的に連続した大きなメモリを確保する
 
 #include <asm/errno.h>		// カーネル内で使用されるエラーコードを提供する
 
 //! デバイスドライバに割り当てられるメジャー番号
 int major;
 
-//! デバイスへの複数アクセスを防ぐために使用
-atomic_t already_open = ATOMIC_INIT(CDEV_NOT_USED);
-
-//! デバイスが返すメッセージ
-char msg[BUF_LEN + 1];
+//! マイナー番号ごとの状態. 各要素はマイナー番号に対応するCPUのNUMAノードから確保する
+struct chardev_minor **minors;
 
 //! device_create()に使用するクラス構造体
 struct class *cls;
 
+//! メッセージの後ろに付け加えるペイロードのサイズ(バイト). 0ならメッセージのみ
+static unsigned long payload_size = 0;
+module_param(payload_size, ulong, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(payload_size, "Size of the payload appended to the message (max 16 MiB)");
+
+//! trueならまとめてコピーし, falseなら従来通り1バイトずつコピーする
+static bool bulk_copy = true;
+module_param(bulk_copy, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(bulk_copy, "Copy to userspace in bulk (1) or one byte at a time (0)");
+
+//! 作成するマイナー番号の数. 1なら/dev/chardevのみ, 0ならCPUごとに/dev/chardev/cpuN, 2以上なら/dev/chardev/Nを作成する
+static unsigned int nr_minors = 1;
+module_param(nr_minors, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(nr_minors, "Number of minors (1: /dev/chardev, 0: one /dev/chardev/cpuN per CPU, N: /dev/chardev/0..N-1)");
+
+//! nr_minorsに0が指定され, CPUごとにマイナー番号を作成するか
+static bool percpu_minors;
+
+//! 全てのオープンで共有する読み取り専用のペイロード(vmallocで確保)
+char *payload;
+
 /**
  * @struct file_operations
  * @brief コールバック関数を登録するためのfile_operations構造体の宣言
  */
 struct file_operations chardev_fops = {
-	.read = device_read,
+	.read_iter = device_read_iter,
+	.splice_read = device_splice_read,
 	.write = device_write,
 	.open = device_open,
 	.release = device_release,
 };
 
+/**
+ * @brief 作成したマイナー番号のデバイスを削除する
+ */
+static void chardev_destroy_minors(unsigned int count) {
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		device_destroy(cls, MKDEV(major, i));
+		cdev_del(&minors[i]->cdev);
+		kfree(minors[i]);
+	}
+
+	kfree(minors);
+}
+
+/**
+ * @brief マイナー番号ごとの状態を確保し, デバイスを作成する
+ * 
+ * 状態はキャッシュラインに揃えて, 対応するCPUのNUMAノードから確保する
+ * 異なるCPUに固定された読み手が同じキャッシュラインを共有することはない
+ */
+static int chardev_create_minors(void) {
+	struct device *dev;
+	unsigned int i;
+	int cpu, ret;
+
+	minors = kcalloc(nr_minors, sizeof(*minors), GFP_KERNEL);
+	if (!minors) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_minors; i++) {
+		cpu = i % nr_cpu_ids;
+
+		minors[i] = kzalloc_node(sizeof(*minors[i]), GFP_KERNEL, cpu_to_node(cpu));
+		if (!minors[i]) {
+			ret = -ENOMEM;
+			goto error;
+		}
+
+		atomic64_set(&minors[i]->open_counter, 0);
+		cdev_init(&minors[i]->cdev, &chardev_fops);
+
+		ret = cdev_add(&minors[i]->cdev, MKDEV(major, i), 1);
+		if (ret) {
+			kfree(minors[i]);
+			goto error;
+		}
+
+		/*
+		 * 1つだけなら/dev/chardev, CPUごとなら/dev/chardev/cpuN, それ以外は/dev/chardev/Nを作成する
+		 * CPUの数を越えるマイナー番号でも名前が重ならないように, CPU番号ではなく添字で名付ける
+		 */
+		if (nr_minors == 1) {
+			dev = device_create(cls, NULL, MKDEV(major, i), NULL, DEVICE_NAME);
+		} else if (percpu_minors) {
+			dev = device_create(cls, NULL, MKDEV(major, i), NULL, DEVICE_NAME "!cpu%d", cpu);
+		} else {
+			dev = device_create(cls, NULL, MKDEV(major, i), NULL, DEVICE_NAME "!%u", i);
+		}
+
+		if (IS_ERR(dev)) {
+			ret = PTR_ERR(dev);
+			cdev_del(&minors[i]->cdev);
+			kfree(minors[i]);
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	chardev_destroy_minors(i);
+	return ret;
+}
+
 /**
  * @brief デバイスの初期化
  */
 static int __init chardev_init(void) {
+	dev_t dev;
+	unsigned long i;
+	int ret;
+
+	if (payload_size > PAYLOAD_MAX) {
+		pr_alert("payload_size %lu exceeds %lu\n", payload_size, PAYLOAD_MAX);
+		return -EINVAL;
+	}
+
+	if (nr_minors == 0) {
+		nr_minors = nr_cpu_ids;
+		percpu_minors = true;
+	}
+
+	if (nr_minors > MINORS_MAX) {
+		pr_alert("nr_minors %u exceeds %u\n", nr_minors, MINORS_MAX);
+		return -EINVAL;
+	}
+
+	/* ペイロードは数MBになりうるので, 物理的に連続している必要のないvmallocで確保する */
+	if (payload_size) {
+		payload = vmalloc(payload_size);
+		if (!payload) {
+			return -ENOMEM;
+		}
+
+		for (i = 0; i < payload_size; i++) {
+			payload[i] = PAYLOAD_PATTERN[i % (sizeof(PAYLOAD_PATTERN) - 1)];
+		}
+	}
+
 	/**
-	 * カーネルにキャラクタデバイスを登録し, メジャー番号を取得 
-	 * 0を渡すと動的にメジャー番号が割り当てられる
+	 * メジャー番号とnr_minors個のマイナー番号を動的に取得する
 	 */
-	major = register_chrdev(0, DEVICE_NAME, &chardev_fops);
+	ret = alloc_chrdev_region(&dev, 0, nr_minors, DEVICE_NAME);
 
-	if (major < 0) {
-		pr_alert("Registering char device failed with %d\n", major);
-		return major;
+	if (ret < 0) {
+		pr_alert("Registering char device failed with %d\n", ret);
+		goto error_region;
 	}
 
+	major = MAJOR(dev);
 	pr_info("I was assigned major number %d.\n", major);
 	
 	/* /dev/chardevを作成し, ユーザがデバイスを簡単にアクセスできるようにする */
@@ -64,35 +198,66 @@ static int __init chardev_init(void) {
 #else
 	cls = class_create(THIS_MODULE, DEVICE_NAME);
 #endif
-	device_create(cls, NULL, MKDEV(major, 0), NULL, DEVICE_NAME);
+	if (IS_ERR(cls)) {
+		ret = PTR_ERR(cls);
+		goto error_class;
+	}
+
+	ret = chardev_create_minors();
+	if (ret) {
+		goto error_minors;
+	}
 
-	pr_info("Device created on /dev/%s\n", DEVICE_NAME);
+	pr_info("%u device(s) created on /dev/%s\n", nr_minors, DEVICE_NAME);
 
 	return SUCCESS;
+
+error_minors:
+	class_destroy(cls);
+error_class:
+	unregister_chrdev_region(dev, nr_minors);
+error_region:
+	vfree(payload);
+	return ret;
 }
 
 /**
  * @brief デバイスの終了. /dev/chardevを削除し, キャラクタデバイスの登録を解除
  */
 static void __exit chardev_exit(void) {
-	device_destroy(cls, MKDEV(major, 0));
+	chardev_destroy_minors(nr_minors);
 	class_destroy(cls);
 
-	unregister_chrdev(major, DEVICE_NAME);
+	unregister_chrdev_region(MKDEV(major, 0), nr_minors);
+
+	vfree(payload);
 }
 
 /**
  * @brief プロセスがsudo cat /dev/chardevのようにデバイスファイルを開こうとしたときに呼び出される
+ * 
+ * オープンごとにメッセージのスナップショットを作成してfile->private_dataに保持する
+ * グローバルなバッファを共有しないため, 複数のプロセスが同時にデバイスを開くことができる
  */
 static int device_open(struct inode *inode, struct file *file) {
-	static int counter = 0;
+	struct chardev_minor *minor = container_of(inode->i_cdev, struct chardev_minor, cdev);
+	struct chardev_snapshot *snapshot;
+	s64 count;
 
-	/* 排他制御を行い, デバイスを同時に1つのプロセスしか開けないようにする */
-	if (atomic_cmpxchg(&already_open, CDEV_NOT_USED, CDEV_EXCLUSIVE_OPEN)) {
-		return -EBUSY;
+	snapshot = kmalloc(sizeof(*snapshot), GFP_KERNEL);
+	if (!snapshot) {
+		return -ENOMEM;
 	}
 
-	sprintf(msg, "I already told you %d times Hello world\n", counter++);
+	/**
+	 * 加算前の値を取得する. ロックなしで他のオープンと重複しない番号が得られる
+	 * カウンタはマイナー番号ごとに持つので, 別のマイナー番号のオープンとは競合しない
+	 */
+	count = atomic64_fetch_inc(&minor->open_counter);
+	snapshot->len = scnprintf(snapshot->msg, sizeof(snapshot->msg),
+							  "I already told you %lld times Hello world\n", count);
+
+	file->private_data = snapshot;
 	try_module_get(THIS_MODULE);
 
 	return SUCCESS;
@@ -102,8 +267,9 @@ static int device_open(struct inode *inode, struct file *file) {
  * @brief デバイスファイルを閉じるときに呼び出される
  */
 static int device_release(struct inode *inode, struct file *file) {
-	/* 排他制御を解除 */
-	atomic_set(&already_open, CDEV_NOT_USED);
+	/* オープン時に作成したスナップショットを解放 */
+	kfree(file->private_data);
+	file->private_data = NULL;
 
 	/* 一度オープンしたら, そのモジュールは決して削除されない */
 	module_put(THIS_MODULE);
@@ -111,35 +277,149 @@ static int device_release(struct inode *inode, struct file *file) {
 	return SUCCESS;
 }
 
+/**
+ * @brief srcからlenバイトをtoへコピーし, コピーできたバイト数を返す
+ * 
+ * bulk_copyがfalseのときは比較用に1バイトずつコピーする
+ */
+static size_t chardev_copy(const char *src, size_t len, struct iov_iter *to) {
+	size_t copied = 0;
+
+	if (bulk_copy) {
+		return copy_to_iter(src, len, to);
+	}
+
+	while (copied < len && iov_iter_count(to)) {
+		if (copy_to_iter(src + copied, 1, to) != 1) {
+			break;
+		}
+		copied++;
+	}
+
+	return copied;
+}
+
 /**
  * すでにdevファイルをオープンしているプロセスが, そのdevファイルから読み込もうとしたときに呼び出される
+ * 
+ * メッセージの後ろにペイロードが続くものとして読み出す
+ * read_iterで実装しているので, readvによる複数バッファへの読み込みも1回のシステムコールで終わる
  */
-static ssize_t device_read(struct file *filp,
-						   char __user *buffer,
-						   size_t length,
-						   loff_t *offset) {
-	/* 実際にバッファに書き込まれたバイト数 */
-	int bytes_read = 0;
-	const char *msg_ptr = msg;
-
-	if (!*(msg_ptr + *offset)) {
-		*offset = 0;
+static ssize_t device_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+	struct chardev_snapshot *snapshot = iocb->ki_filp->private_data;
+	size_t total = snapshot->len + payload_size;
+	loff_t pos = iocb->ki_pos;
+	size_t requested = iov_iter_count(to);
+	size_t copied = 0;
+	size_t len;
+
+	if (pos >= total || !requested) {
 		return 0;
 	}
 
-	msg_ptr += *offset;
+	/* まずオープン時に作成したメッセージをコピーする */
+	if (pos < snapshot->len) {
+		len = snapshot->len - pos;
+		copied += chardev_copy(snapshot->msg + pos, len, to);
+		if (copied < min(len, requested)) {
+			goto out;
+		}
+	}
+
+	/* 続けてペイロードをコピーする */
+	pos += copied;
+	if (pos < total && iov_iter_count(to)) {
+		copied += chardev_copy(payload + (pos - snapshot->len), total - pos, to);
+	}
 
-	/* 実際にデータをバッファに入れる */
-	while (length && *msg_ptr) {
-		put_user(*(msg_ptr++), buffer++);
-		length--;
-		bytes_read++;
+out:
+	if (!copied) {
+		return -EFAULT;
 	}
 
-	*offset += bytes_read;
+	/* オフセットを更新する */
+	iocb->ki_pos += copied;
 
 	/* バッファに入れられたバイト数を返す */
-	return bytes_read;
+	return copied;
+}
+
+/**
+ * @brief splice_to_pipe()がパイプに渡せなかったページの参照を解放する
+ */
+static void chardev_spd_release(struct splice_pipe_desc *spd, unsigned int i) {
+	put_page(spd->pages[i]);
+}
+
+/**
+ * @brief splice()やsendfile()でデバイスからパイプへ読み込むときに呼び出される
+ * 
+ * ペイロードはvmallocで確保したページをそのままパイプに渡すので, データのコピーは発生しない
+ * オープンごとのメッセージは小さいので, 新しいページにコピーして渡す
+ */
+static ssize_t device_splice_read(struct file *filp, loff_t *ppos,
+								  struct pipe_inode_info *pipe, size_t len,
+								  unsigned int flags) {
+	struct chardev_snapshot *snapshot = filp->private_data;
+	size_t total = snapshot->len + payload_size;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &nosteal_pipe_buf_ops,
+		.spd_release = chardev_spd_release,
+	};
+	loff_t pos = *ppos;
+	ssize_t ret;
+
+	if (pos >= total) {
+		return 0;
+	}
+
+	len = min_t(size_t, len, total - pos);
+
+	/* メッセージ部分をページにコピーする */
+	if (pos < snapshot->len) {
+		size_t n = min_t(size_t, len, snapshot->len - pos);
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			return -ENOMEM;
+		}
+
+		memcpy(page_address(page), snapshot->msg + pos, n);
+		pages[0] = page;
+		partial[0].offset = 0;
+		partial[0].len = n;
+		spd.nr_pages = 1;
+		pos += n;
+		len -= n;
+	}
+
+	/* ペイロードのページは参照カウントを増やしてそのまま渡す */
+	while (len && spd.nr_pages < PIPE_DEF_BUFFERS) {
+		const char *src = payload + (pos - snapshot->len);
+		size_t offset = offset_in_page(src);
+		size_t n = min_t(size_t, len, PAGE_SIZE - offset);
+		struct page *page = vmalloc_to_page(src);
+
+		get_page(page);
+		pages[spd.nr_pages] = page;
+		partial[spd.nr_pages].offset = offset;
+		partial[spd.nr_pages].len = n;
+		spd.nr_pages++;
+		pos += n;
+		len -= n;
+	}
+
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret > 0) {
+		*ppos += ret;
+	}
+
+	return ret;
 }
 
 /**
@@ -6,8 +6,12 @@
 #ifndef CHARDEV_H
 #define CHARDEV_H
 
+#include <linux/atomic.h>	/* アトミック操作を提供する */
+#include <linux/cache.h>	/* キャッシュラインに揃えるためのマクロを提供する */
+#include <linux/cdev.h>		/* キャラクタデバイス（cdev）の管理を行う */
 #include <linux/fs.h>		/* ファイルシステム関連の機能を提供する */
 #include <linux/types.h>	/* カーネル内で使用されるデータ型を定義する */
+#include <linux/uio.h>		/* read_iterで使用するiov_iterを定義する */
 
 /**
  * @def デバイスの名前
@@ -18,6 +22,22 @@
  * @def バッファの最大サイズ
  */
 #define BUF_LEN 80
+
+/**
+ * @def ペイロードの最大サイズ(16MiB)
+ */
+#define PAYLOAD_MAX (16UL << 20)
+
+/**
+ * @def ペイロードを埋める文字列. ペイロードの長さになるまで繰り返す
+ */
+#define PAYLOAD_PATTERN "Hello world\n"
+
+/**
+ * @def 作成できるマイナー番号の最大数
+ */
+#define MINORS_MAX 4096U
+
 /**
  * @def 成功フラグ. 関数が成功したときに返す
  */
@@ -36,7 +56,13 @@ static int device_release(struct inode *, struct file *);
 /**
  * @brief すでにdevファイルをオープンしているプロセスが, そのdevファイルから読み込もうとしたときに呼び出される
  */
-static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t device_read_iter(struct kiocb *, struct iov_iter *);
+
+/**
+ * @brief splice()やsendfile()でデバイスからパイプへ読み込むときに呼び出される
+ */
+static ssize_t device_splice_read(struct file *, loff_t *, struct pipe_inode_info *,
+								  size_t, unsigned int);
 
 /**
  * @brief プロセスがdevファイルに書き込むときに呼び出される
@@ -44,25 +70,39 @@ static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t device_write(struct file *, const char __user *, size_t, loff_t *);
 
 /**
- * @enum デバイスへの複数アクセスを防ぐための列挙体	
+ * @struct chardev_snapshot
+ * @brief オープンごとに作成するメッセージ. file->private_dataに保持する
  */
-enum {
-	CDEV_NOT_USED,
-	CDEV_EXCLUSIVE_OPEN,
+struct chardev_snapshot {
+	//! メッセージの長さ
+	size_t len;
+	//! オープン時に作成したメッセージ
+	char msg[BUF_LEN + 1];
 };
 
+/**
+ * @struct chardev_minor
+ * @brief マイナー番号ごとの状態. 他のマイナー番号とキャッシュラインを共有しないように揃える
+ */
+struct chardev_minor {
+	//! このマイナー番号がオープンされた回数
+	atomic64_t open_counter;
+	//! このマイナー番号のキャラクタデバイス
+	struct cdev cdev;
+} ____cacheline_aligned_in_smp;
+
 //! デバイスドライバに割り当てられるメジャー番号
 extern int major;
 
-//! デバイスへの複数アクセスを防ぐために使用
-extern atomic_t already_open;
-
-//! デバイスが返すメッセージ
-extern char msg[BUF_LEN + 1];
+//! マイナー番号ごとの状態
+extern struct chardev_minor **minors;
 
 //! device_create()に使用するクラス構造体
 extern struct class *cls;
 
+//! 全てのオープンで共有する読み取り専用のペイロード
+extern char *payload;
+
 //! コールバック関数を登録するためのfile_operations構造体の宣言
 extern struct file_operations chardev_fops;
 
@@ -0,0 +1,155 @@
+/**
+ * @file chardev_bench.c
+ *
+ * /dev/chardevに対してopen -> read -> closeを繰り返し, 1秒あたりの回数を計測する
+ * スレッド数を1から全コアまで増やしていき, 同時オープンがスケールするかを確認する
+ * nr_minors=0でロードして/dev/chardev/cpuNがある場合は, 各スレッドが固定したCPUのデバイスを開く
+ *
+ * 使用例 -- sudo ./chardev_bench [秒数] [最大スレッド数]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/chardev"
+#define PERCPU_DEVICE_PATH "/dev/chardev/cpu%d"
+#define READ_SIZE 128
+
+//! CPUごとのデバイスを使うかどうか
+static int percpu;
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	char path[64];
+	unsigned long ops;
+	unsigned long busy;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief 指定したCPUに固定して, open/read/closeを繰り返す
+ */
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = arg;
+	char buffer[READ_SIZE];
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	if (percpu) {
+		snprintf(t->path, sizeof(t->path), PERCPU_DEVICE_PATH, t->cpu);
+	} else {
+		snprintf(t->path, sizeof(t->path), "%s", DEVICE_PATH);
+	}
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		int fd = open(t->path, O_RDONLY);
+
+		if (fd < 0) {
+			if (errno == EBUSY) {
+				t->busy++;
+			} else {
+				t->errors++;
+			}
+			continue;
+		}
+
+		while (read(fd, buffer, sizeof(buffer)) > 0) {
+		}
+
+		close(fd);
+		t->ops++;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief nthreads個のスレッドで計測し, 結果を表示する
+ */
+static int run(int nthreads, int seconds) {
+	struct bench_thread *threads;
+	struct timespec start, end;
+	unsigned long ops = 0, busy = 0, errors = 0;
+	double elapsed;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * nthreads);
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus };
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		busy += threads[i].busy;
+		errors += threads[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%8d %16.0f %16.0f %10lu %10lu\n", nthreads, ops / elapsed,
+		   ops / elapsed / nthreads, busy, errors);
+
+	free(threads);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int n;
+
+	if (seconds <= 0 || max_threads <= 0) {
+		printf("Usage: %s [seconds] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	percpu = access("/dev/chardev/cpu0", F_OK) == 0;
+	printf("device: %s\n", percpu ? PERCPU_DEVICE_PATH : DEVICE_PATH);
+
+	printf("%8s %16s %16s %10s %10s\n", "threads", "ops/s", "ops/s/thread", "EBUSY", "errors");
+
+	/* 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する */
+	for (n = 1; n < max_threads; n *= 2) {
+		if (run(n, seconds)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (run(max_threads, seconds)) {
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file chardev_read_bench.c
+ *
+ * /dev/chardevの読み込み速度を計測する
+ * 1バイトずつコピーする従来の方法(bulk_copy=0)とまとめてコピーする方法(bulk_copy=1)を,
+ * read()とreadv()のそれぞれで比較し, bytes/sと1MBあたりのシステムコール数を表示する
+ *
+ * payload_sizeを指定してモジュールをロードしてから実行する
+ * 例 -- sudo insmod chardev.ko payload_size=4194304
+ *       sudo ./chardev_read_bench [読み込みバッファのサイズ] [readvの分割数]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/chardev"
+#define BULK_COPY_PARAM "/sys/module/chardev/parameters/bulk_copy"
+
+//! 1回の計測で最低限読み込むバイト数
+#define MIN_TOTAL_BYTES (256UL << 20)
+
+//! 1回の計測にかける最長時間(秒)
+#define MAX_SECONDS 5.0
+
+/**
+ * @brief bulk_copyパラメータを書き換える
+ */
+static int set_bulk_copy(int enable) {
+	FILE *fp = fopen(BULK_COPY_PARAM, "w");
+
+	if (!fp) {
+		perror(BULK_COPY_PARAM);
+		return -1;
+	}
+
+	fprintf(fp, "%d\n", enable);
+	fclose(fp);
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief デバイスを開いて末尾まで読み込むことを繰り返し, 結果を表示する
+ *
+ * @param label 表示用の名前
+ * @param buffer 読み込み先のバッファ
+ * @param size バッファのサイズ
+ * @param niov 0ならread(), 1以上ならバッファをniov個に分けてreadv()を使う
+ */
+static int run(const char *label, char *buffer, size_t size, int niov) {
+	struct iovec *iov = NULL;
+	unsigned long bytes = 0, syscalls = 0;
+	double start, elapsed;
+	ssize_t ret;
+	int i;
+
+	if (niov) {
+		iov = calloc(niov, sizeof(*iov));
+		if (!iov) {
+			perror("calloc");
+			return -1;
+		}
+		for (i = 0; i < niov; i++) {
+			iov[i].iov_base = buffer + size / niov * i;
+			iov[i].iov_len = size / niov;
+		}
+	}
+
+	start = now();
+	do {
+		int fd = open(DEVICE_PATH, O_RDONLY);
+
+		if (fd < 0) {
+			perror("open");
+			free(iov);
+			return -1;
+		}
+
+		do {
+			ret = niov ? readv(fd, iov, niov) : read(fd, buffer, size);
+			syscalls++;
+			if (ret > 0) {
+				bytes += ret;
+			}
+		} while (ret > 0);
+
+		close(fd);
+
+		if (ret < 0) {
+			perror("read");
+			free(iov);
+			return -1;
+		}
+
+		elapsed = now() - start;
+	} while (bytes < MIN_TOTAL_BYTES && elapsed < MAX_SECONDS);
+
+	printf("%-20s %14.1f MB/s %14.2f syscalls/MB\n", label,
+		   bytes / elapsed / (1 << 20), syscalls / ((double)bytes / (1 << 20)));
+
+	free(iov);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : (4UL << 20);
+	int niov = argc > 2 ? atoi(argv[2]) : 64;
+	char *buffer;
+	int ret = 0;
+
+	if (size == 0 || niov <= 0 || size < (size_t)niov) {
+		printf("Usage: %s [buffer size] [number of iovecs]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	buffer = malloc(size);
+	if (!buffer) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("buffer: %zu bytes, readv: %d iovecs\n", size, niov);
+
+	/* 従来の1バイトずつコピーする方法 */
+	if (set_bulk_copy(0) == 0) {
+		ret |= run("per-byte read", buffer, size, 0);
+		ret |= run("per-byte readv", buffer, size, niov);
+	}
+
+	/* まとめてコピーする方法 */
+	if (set_bulk_copy(1) == 0) {
+		ret |= run("bulk read", buffer, size, 0);
+		ret |= run("bulk readv", buffer, size, niov);
+	}
+
+	free(buffer);
+	return ret ? EXIT_FAILURE : 0;
+}
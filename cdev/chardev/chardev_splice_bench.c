@@ -0,0 +1,144 @@
+/**
+ * @file chardev_splice_bench.c
+ *
+ * デバイスの内容を出力先へ転送する速度を, 次の3つの方法で比較する
+ * - read() + write(): ユーザ空間のバッファを経由する
+ * - splice(): デバイス -> パイプ -> 出力先と, ユーザ空間を経由せずに転送する
+ * - sendfile(): カーネル内部でsplice()と同じ経路を使う
+ *
+ * 例 -- sudo insmod chardev.ko payload_size=16777216
+ *       sudo ./chardev_splice_bench [デバイス] [出力先]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <time.h>
+#include <unistd.h>
+
+//! 1回の転送で扱う最大バイト数
+#define CHUNK_SIZE (1 << 20)
+
+//! 1つの方法あたりの計測時間(秒)
+#define BENCH_SECONDS 3.0
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief read()とwrite()でinからoutへ末尾まで転送する
+ */
+static ssize_t copy_read_write(int in, int out) {
+	static char buffer[CHUNK_SIZE];
+	ssize_t total = 0, n;
+
+	while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+		if (write(out, buffer, n) != n) {
+			return -1;
+		}
+		total += n;
+	}
+
+	return n < 0 ? -1 : total;
+}
+
+/**
+ * @brief パイプを経由してsplice()でinからoutへ末尾まで転送する
+ */
+static ssize_t copy_splice(int in, int out) {
+	static int pipefd[2] = { -1, -1 };
+	ssize_t total = 0, n, m;
+
+	if (pipefd[0] < 0) {
+		if (pipe(pipefd) < 0) {
+			return -1;
+		}
+		fcntl(pipefd[1], F_SETPIPE_SZ, CHUNK_SIZE);
+	}
+
+	while ((n = splice(in, NULL, pipefd[1], NULL, CHUNK_SIZE, SPLICE_F_MOVE)) > 0) {
+		/* パイプに入った分を全て出力先へ流す */
+		while (n > 0) {
+			m = splice(pipefd[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+			if (m <= 0) {
+				return -1;
+			}
+			n -= m;
+			total += m;
+		}
+	}
+
+	return n < 0 ? -1 : total;
+}
+
+/**
+ * @brief sendfile()でinからoutへ末尾まで転送する
+ */
+static ssize_t copy_sendfile(int in, int out) {
+	ssize_t total = 0, n;
+
+	while ((n = sendfile(out, in, NULL, CHUNK_SIZE)) > 0) {
+		total += n;
+	}
+
+	return n < 0 ? -1 : total;
+}
+
+/**
+ * @brief デバイスを開いて末尾まで転送することを繰り返し, スループットを表示する
+ */
+static int run(const char *label, const char *device, int out,
+			   ssize_t (*copy)(int, int)) {
+	unsigned long bytes = 0;
+	double start = now(), elapsed;
+
+	do {
+		int in = open(device, O_RDONLY);
+		ssize_t n;
+
+		if (in < 0) {
+			perror(device);
+			return -1;
+		}
+
+		n = copy(in, out);
+		close(in);
+
+		if (n < 0) {
+			perror(label);
+			return -1;
+		}
+
+		bytes += n;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	printf("%-12s %12.1f MB/s\n", label, bytes / elapsed / (1 << 20));
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = argc > 1 ? argv[1] : "/dev/chardev";
+	const char *output = argc > 2 ? argv[2] : "/dev/null";
+	int out, ret = 0;
+
+	out = open(output, O_WRONLY);
+	if (out < 0) {
+		perror(output);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%s -> %s\n", device, output);
+
+	ret |= run("read+write", device, out, copy_read_write);
+	ret |= run("splice", device, out, copy_splice);
+	ret |= run("sendfile", device, out, copy_sendfile);
+
+	close(out);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -6,17 +6,347 @@
  */
 #include "ioctl-1.h"
 
+#define CREATE_TRACE_POINTS
+#include "test_ioctl_trace.h"
+
 //! デバイスのメジャー番号(動的に決定される)
 unsigned int test_ioctl_major = 0;
 
-//! 作成するデバイスの数(1つ)
+//! 作成するデバイスの数. 全てのマイナー番号を1つのcdevで受け付ける
 unsigned int num_of_dev = 1;
+module_param(num_of_dev, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(num_of_dev, "Number of minors to create (up to 1048576)");
 
 //! キャラクタデバイスの構造体
 static struct cdev test_ioctl_cdev;
 
+//! マイナー番号ごとの状態. 最初のオープンで登録するので, 使われていないマイナー番号はメモリを使わない
+static DEFINE_XARRAY(test_ioctl_minors);
+
+//! マイナー番号ごとの状態を確保するためのスラブキャッシュ
+static struct kmem_cache *test_ioctl_minor_cache;
+
+//! オープンごとのデータを確保するためのスラブキャッシュ
+static struct kmem_cache *test_ioctl_cache;
+
 //! 数値データのやり取りに使う変数
-int ioctl_num = 0;
+atomic64_t ioctl_num = ATOMIC64_INIT(0);
+
+//! オープン中のデータのリスト. ioctl_numの変更を全てのレジスタページに反映するために使う
+static LIST_HEAD(test_ioctl_list);
+
+//! test_ioctl_listとレジスタページへのioctl_numの反映を保護する
+static DEFINE_SPINLOCK(test_ioctl_list_lock);
+
+//! valをロックを取らずにシーケンスカウンタで読み込むかどうか. 0にするとrwlockで読み込む
+static bool lockless_read = true;
+module_param(lockless_read, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(lockless_read, "Read val through a seqcount instead of the rwlock");
+
+//! readでページ単位にまとめてコピーするかどうか. 0にすると比較用に1バイトずつコピーする
+static bool bulk_copy = true;
+module_param(bulk_copy, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(bulk_copy, "Copy to userspace in page-sized chunks (1) or one byte at a time (0)");
+
+//! open, close, VALSETのたびにカーネルログへ出力するかどうか. 通常はトレースポイントを使う
+static bool log_calls = false;
+module_param(log_calls, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(log_calls, "Also log every open, close and VALSET with printk");
+
+/**
+ * @brief デバイスのvalを読み込む
+ * 
+ * 多数のスレッドが同じファイルを共有すると, read_lock()でもロックのキャッシュラインが
+ * コア間を行き来する. lockless_readなら共有データに書き込まず, シーケンスカウンタで
+ * 書き込みと重なっていないことを確かめるだけで読み込む
+ */
+static unsigned char test_ioctl_get_val(struct test_ioctl_data *ioctl_data) {
+	unsigned char val;
+	unsigned int seq;
+
+	if (!READ_ONCE(lockless_read)) {
+		read_lock(&ioctl_data->lock);
+		val = ioctl_data->val;
+		read_unlock(&ioctl_data->lock);
+		return val;
+	}
+
+	/* 書き込みと重なったら読み直す */
+	do {
+		seq = read_seqcount_begin(&ioctl_data->seq);
+		val = ioctl_data->val;
+	} while (read_seqcount_retry(&ioctl_data->seq, seq));
+
+	return val;
+}
+
+/**
+ * @brief レジスタページの更新を始める. seqを奇数にして, ユーザ空間の読み込みに待たせる
+ * 
+ * レジスタページの書き込み側は, そのデータのrwlockで直列化する
+ */
+static void test_ioctl_regs_begin(struct ioctl_regs *regs) {
+	WRITE_ONCE(regs->seq, regs->seq + 1);
+	smp_wmb();
+}
+
+/**
+ * @brief レジスタページの更新を終える. seqを偶数に戻す
+ */
+static void test_ioctl_regs_end(struct ioctl_regs *regs) {
+	smp_wmb();
+	WRITE_ONCE(regs->seq, regs->seq + 1);
+}
+
+/**
+ * @brief valを書き込む. 書き込み側のrwlockを持って呼び出す
+ * 
+ * 値が変わったときは, readでコピーするパターンも同じシーケンスの中で埋め直す
+ */
+static void test_ioctl_store_val(struct test_ioctl_data *ioctl_data, unsigned char val) {
+	if (ioctl_data->val == val) {
+		return;
+	}
+
+	write_seqcount_begin(&ioctl_data->seq);
+	ioctl_data->val = val;
+
+	/* パターンとレジスタページは, まだ確保されていなければ確保するときに埋める */
+	if (ioctl_data->pattern) {
+		memset(ioctl_data->pattern, val, PAGE_SIZE);
+	}
+
+	if (ioctl_data->regs) {
+		test_ioctl_regs_begin(ioctl_data->regs);
+		WRITE_ONCE(ioctl_data->regs->val, val);
+		test_ioctl_regs_end(ioctl_data->regs);
+	}
+	write_seqcount_end(&ioctl_data->seq);
+}
+
+/**
+ * @brief デバイスのvalを書き換える. 書き込み側はrwlockで直列化する
+ */
+static void test_ioctl_set_val(struct test_ioctl_data *ioctl_data, unsigned char val) {
+	write_lock(&ioctl_data->lock);
+	test_ioctl_store_val(ioctl_data, val);
+	write_unlock(&ioctl_data->lock);
+
+	trace_test_ioctl_set(ioctl_data, val);
+}
+
+/**
+ * @brief valにdeltaを加える. 読み込みから書き込みまで書き込み側のrwlockを持つので, 他の更新と重ならない
+ * 
+ * valの書き込みはパターンとレジスタページの埋め直しを伴うので, atomic操作ではなくrwlockで直列化する
+ * 
+ * @return 加える前の値
+ */
+static unsigned char test_ioctl_fetch_add_val(struct test_ioctl_data *ioctl_data, s64 delta) {
+	unsigned char old;
+
+	write_lock(&ioctl_data->lock);
+	old = ioctl_data->val;
+	test_ioctl_store_val(ioctl_data, old + delta);
+	write_unlock(&ioctl_data->lock);
+
+	trace_test_ioctl_set(ioctl_data, (unsigned char)(old + delta));
+	return old;
+}
+
+/**
+ * @brief valが*expectedと等しければdesiredに書き換える. 比較と書き込みは下位8ビットで行う
+ * 
+ * @return 交換できたらtrue. *expectedには実行時の値を書き込む
+ */
+static bool test_ioctl_cas_val(struct test_ioctl_data *ioctl_data, s64 *expected, s64 desired) {
+	unsigned char old;
+	bool swapped;
+
+	write_lock(&ioctl_data->lock);
+	old = ioctl_data->val;
+	swapped = old == (unsigned char)*expected;
+	if (swapped) {
+		test_ioctl_store_val(ioctl_data, desired);
+	}
+	write_unlock(&ioctl_data->lock);
+
+	if (swapped) {
+		trace_test_ioctl_set(ioctl_data, (unsigned char)desired);
+	}
+
+	*expected = old;
+	return swapped;
+}
+
+/**
+ * @brief ioctl_numの変更を, mmap()されている全てのレジスタページに反映する
+ * 
+ * どのレジスタページもmmap()されていなければ, リストのロックを取らずに済ませる
+ */
+static void test_ioctl_publish_num(void) {
+	struct test_ioctl_data *ioctl_data;
+	int num;
+
+	/* ioctl_numの更新とリストの読み込みの順序を守る. test_ioctl_get_regs()のsmp_mb()と対になる */
+	smp_mb();
+	if (list_empty(&test_ioctl_list)) {
+		return;
+	}
+
+	spin_lock(&test_ioctl_list_lock);
+
+	/* ロックの中で最新の値を読むので, 更新が重なっても最後に反映されるのは最新の値になる */
+	num = atomic64_read(&ioctl_num);
+
+	list_for_each_entry(ioctl_data, &test_ioctl_list, node) {
+		write_lock(&ioctl_data->lock);
+		test_ioctl_regs_begin(ioctl_data->regs);
+		WRITE_ONCE(ioctl_data->regs->num, num);
+		test_ioctl_regs_end(ioctl_data->regs);
+		write_unlock(&ioctl_data->lock);
+	}
+
+	spin_unlock(&test_ioctl_list_lock);
+}
+
+/**
+ * @brief ioctl_numを書き換え, mmap()されている全てのレジスタページに反映する
+ */
+static void test_ioctl_set_num(int num) {
+	atomic64_set(&ioctl_num, num);
+	test_ioctl_publish_num();
+}
+
+/**
+ * @brief ioctl_numにdeltaを不可分に加える
+ * 
+ * @return 加える前の値
+ */
+static s64 test_ioctl_fetch_add_num(s64 delta) {
+	s64 old = atomic64_fetch_add(delta, &ioctl_num);
+
+	if (delta) {
+		test_ioctl_publish_num();
+	}
+	return old;
+}
+
+/**
+ * @brief ioctl_numが*expectedと等しければdesiredに不可分に書き換える
+ * 
+ * @return 交換できたらtrue. *expectedには実行時の値を書き込む
+ */
+static bool test_ioctl_cas_num(s64 *expected, s64 desired) {
+	s64 old = atomic64_cmpxchg(&ioctl_num, *expected, desired);
+	bool swapped = old == *expected;
+
+	*expected = old;
+	if (swapped) {
+		test_ioctl_publish_num();
+	}
+	return swapped;
+}
+
+/**
+ * @brief IOCTL_BATCHの1つのコマンドを実行し, 結果をentryに書き込む
+ * 
+ * 値はポインタではなくentry->argで直接やり取りするので, ユーザ空間へのコピーは発生しない
+ */
+static void test_ioctl_batch_one(struct test_ioctl_data *ioctl_data,
+								 struct ioctl_batch_entry *entry)
+{
+	entry->result = 0;
+
+	switch (entry->cmd) {
+	case IOCTL_VALSET:
+		test_ioctl_set_val(ioctl_data, entry->arg);
+		break;
+
+	case IOCTL_VALGET:
+		entry->arg = test_ioctl_get_val(ioctl_data);
+		trace_test_ioctl_get(ioctl_data, entry->arg);
+		break;
+
+	case IOCTL_VALGET_NUM:
+		entry->arg = (int)atomic64_read(&ioctl_num);
+		break;
+
+	case IOCTL_VALSET_NUM:
+		test_ioctl_set_num(entry->arg);
+		break;
+
+	case IOCTL_NUM_FETCH_ADD:
+		entry->arg = test_ioctl_fetch_add_num(entry->arg);
+		break;
+
+	case IOCTL_VAL_FETCH_ADD:
+		entry->arg = test_ioctl_fetch_add_val(ioctl_data, entry->arg);
+		break;
+
+	/* IOCTL_BATCHの入れ子と, 引数が2つあるCASは受け付けない */
+	default:
+		entry->result = -ENOTTY;
+	}
+}
+
+/**
+ * @brief 配列で渡された複数のコマンドを1回のシステムコールで順に実行する
+ * 
+ * 配列はIOCTL_BATCH_CHUNK個ずつスタック上にコピーして実行し, 結果をまとめて書き戻す
+ * 
+ * @param ioctl_data: デバイスの内部データ
+ * @param arg: ユーザ空間のstruct ioctl_batchへのポインタ
+ * 
+ * @return 0なら成功. 個々のコマンドの失敗は各要素のresultで返す
+ */
+static long test_ioctl_batch(struct test_ioctl_data *ioctl_data, unsigned long arg)
+{
+	struct ioctl_batch __user *ubatch = (struct ioctl_batch __user *)arg;
+	struct ioctl_batch_entry entries[IOCTL_BATCH_CHUNK];
+	struct ioctl_batch_entry __user *uentries;
+	struct ioctl_batch batch;
+	unsigned int done = 0;
+	unsigned int i, n;
+	long retval = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch))) {
+		return -EFAULT;
+	}
+
+	if (batch.nr > IOCTL_BATCH_MAX) {
+		return -EINVAL;
+	}
+
+	uentries = u64_to_user_ptr(batch.entries);
+
+	while (done < batch.nr) {
+		n = min_t(unsigned int, batch.nr - done, IOCTL_BATCH_CHUNK);
+
+		if (copy_from_user(entries, uentries + done, n * sizeof(entries[0]))) {
+			retval = -EFAULT;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			test_ioctl_batch_one(ioctl_data, &entries[i]);
+		}
+
+		if (copy_to_user(uentries + done, entries, n * sizeof(entries[0]))) {
+			retval = -EFAULT;
+			break;
+		}
+
+		done += n;
+	}
+
+	/* 結果を書き戻せた要素数を返す */
+	if (put_user(done, &ubatch->done)) {
+		retval = -EFAULT;
+	}
+
+	return retval;
+}
 
 /**
  * @brief ioctlシステムコールの処理
@@ -36,6 +366,8 @@ static long test_ioctl_ioctl(struct file *file, unsigned int cmd,
 	int retval = 0;
 	unsigned char val;
 	struct ioctl_arg data;
+	struct ioctl_cas cas;
+	s64 num;
 	memset(&data, 0, sizeof(data));
 
 	/* ユーザが指定したcmdに応じた操作を実行する */
@@ -47,21 +379,17 @@ static long test_ioctl_ioctl(struct file *file, unsigned int cmd,
 			goto done;
 		}
 
-		pr_alert("IOCTL set val:%x .\n", data.val);
-		/* ioctl_data->valの書き込みを保護 */
-		write_lock(&ioctl_data->lock);
-		ioctl_data->val = data.val;
-		/* ロックを解除 */
-		write_unlock(&ioctl_data->lock);
+		/* 呼び出しごとのログはコンソールのロックで詰まるので, 通常はトレースポイントだけにする */
+		if (log_calls) {
+			pr_alert("IOCTL set val:%x .\n", data.val);
+		}
+		test_ioctl_set_val(ioctl_data, data.val);
 		break;
 
 	/* デバイスに保存されているvalをユーザに返す */
 	case IOCTL_VALGET:
-		/* 読み取りを保護 */
-		read_lock(&ioctl_data->lock);
-		val = ioctl_data->val;
-		/* ロックを解除 */
-		read_unlock(&ioctl_data->lock);
+		val = test_ioctl_get_val(ioctl_data);
+		trace_test_ioctl_get(ioctl_data, val);
 		data.val = val;
 
 		/* ユーザ空間へvalをコピー */
@@ -75,13 +403,57 @@ static long test_ioctl_ioctl(struct file *file, unsigned int cmd,
 	/* ioctl_numをユーザに返す */
 	case IOCTL_VALGET_NUM:
 		/* ioctl_numをユーザ空間にコピー */
-		retval = __put_user(ioctl_num, (int __user *)arg);
+		retval = __put_user((int)atomic64_read(&ioctl_num), (int __user *)arg);
 		break;
 
 	/* ioctl_numにユーザが指定した値を渡す */
 	case IOCTL_VALSET_NUM:
 		/* ioctl_numにargをセット */
-		ioctl_num = arg;
+		test_ioctl_set_num(arg);
+		break;
+
+	/* ioctl_numまたはvalを比較して交換する. 交換できたら1を返す */
+	case IOCTL_NUM_CAS:
+	case IOCTL_VAL_CAS:
+		if (copy_from_user(&cas, (void __user *)arg, sizeof(cas))) {
+			retval = -EFAULT;
+			goto done;
+		}
+
+		if (cmd == IOCTL_NUM_CAS) {
+			retval = test_ioctl_cas_num(&cas.expected, cas.desired);
+		} else {
+			retval = test_ioctl_cas_val(ioctl_data, &cas.expected, cas.desired);
+		}
+
+		/* 実行時の値を書き戻す */
+		if (put_user(cas.expected, &((struct ioctl_cas __user *)arg)->expected)) {
+			retval = -EFAULT;
+		}
+		break;
+
+	/* ioctl_numまたはvalに加え, 加える前の値を書き戻す */
+	case IOCTL_NUM_FETCH_ADD:
+	case IOCTL_VAL_FETCH_ADD:
+		if (get_user(num, (s64 __user *)arg)) {
+			retval = -EFAULT;
+			goto done;
+		}
+
+		if (cmd == IOCTL_NUM_FETCH_ADD) {
+			num = test_ioctl_fetch_add_num(num);
+		} else {
+			num = test_ioctl_fetch_add_val(ioctl_data, num);
+		}
+
+		if (put_user(num, (s64 __user *)arg)) {
+			retval = -EFAULT;
+		}
+		break;
+
+	/* 複数のコマンドを順に実行する */
+	case IOCTL_BATCH:
+		retval = test_ioctl_batch(ioctl_data, arg);
 		break;
 
 	default:
@@ -92,79 +464,344 @@ done:
 	return retval;
 }
 
+#ifdef TEST_IOCTL_URING_CMD
 /**
- * @brief ユーザがreadしたとき, デバイスに保存されているvalを読み取る
+ * @brief io_uringのIORING_OP_URING_CMDで送られたコマンドを処理する
+ * 
+ * cmd_opにioctlと同じコマンド番号, SQEのコマンド領域にstruct ioctl_uring_cmdを置く
+ * どのコマンドもその場で終わるので, ioctlと同じ処理を呼び出して結果をそのままCQEで返す
+ * 非同期ランタイムはスレッドを占有せずに, 多数のコマンドをまとめて投入, 回収できる
+ * 
+ * @param ioucmd: io_uringから渡されたコマンド
+ * @param issue_flags: 投入時のフラグ(IO_URING_F_*)
+ * 
+ * @return 0なら成功. CQEのresに入る
+ */
+static int test_ioctl_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	const struct ioctl_uring_cmd *pdu = io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	const struct ioctl_uring_cmd *pdu = ioucmd->cmd;
+#endif
+
+	/* SQEはユーザ空間と共有しているので, 一度だけ読み込む */
+	return test_ioctl_ioctl(ioucmd->file, ioucmd->cmd_op, READ_ONCE(pdu->arg));
+}
+#endif /* TEST_IOCTL_URING_CMD */
+
+/**
+ * @brief srcからlenバイトをtoへコピーし, コピーできたバイト数を返す
+ * 
+ * bulk_copyがfalseのときは比較用に1バイトずつコピーする
+ */
+static size_t test_ioctl_copy(const unsigned char *src, size_t len, struct iov_iter *to) {
+	size_t copied = 0;
+
+	if (bulk_copy) {
+		return copy_to_iter(src, len, to);
+	}
+
+	while (copied < len) {
+		if (copy_to_iter(src + copied, 1, to) != 1) {
+			break;
+		}
+		copied++;
+	}
+
+	return copied;
+}
+
+/**
+ * @brief readでコピーするパターンのページを返す. 最初のreadのときに確保してvalで埋める
+ * 
+ * 読み込まないオープンではページを確保しないので, open/closeが速くなる
+ * 
+ * @return パターンのページ. 確保できなければNULL
+ */
+static unsigned char *test_ioctl_get_pattern(struct test_ioctl_data *ioctl_data) {
+	unsigned char *pattern = smp_load_acquire(&ioctl_data->pattern);
+
+	if (pattern) {
+		return pattern;
+	}
+
+	pattern = (unsigned char *)__get_free_page(GFP_KERNEL);
+
+	if (pattern == NULL) {
+		return NULL;
+	}
+
+	/* valの書き換えと重ならないように埋めてから公開する */
+	write_lock(&ioctl_data->lock);
+	if (ioctl_data->pattern) {
+		/* 別のスレッドが先に確保した */
+		write_unlock(&ioctl_data->lock);
+		free_page((unsigned long)pattern);
+		return ioctl_data->pattern;
+	}
+	memset(pattern, ioctl_data->val, PAGE_SIZE);
+	smp_store_release(&ioctl_data->pattern, pattern);
+	write_unlock(&ioctl_data->lock);
+
+	return pattern;
+}
+
+/**
+ * @brief ユーザがreadしたとき, デバイスに保存されているvalを要求された長さだけ返す
  * カーネル空間->ユーザ空間
  * 
- * @param file: オープンされているデバイスファイル
- * @param buf: ユーザ空間のバッファ(データをコピーする先)
- * @param count: 読み込むデータのバイト数
- * @param f_pos: ファイルのオフセット
+ * valで埋めておいたパターンのページを, ページ単位でコピーする
+ * read_iterで実装しているので, readvによる複数バッファへの読み込みも1回のシステムコールで終わる
+ * コピー中はページフォルトで眠ることがあるためrwlockは取れない. シーケンスカウンタで
+ * VALSETと重なったことを検出したら, コピーした分を巻き戻して読み直す
+ * 
+ * @param iocb: オープンされているデバイスファイルを含む入出力の情報
+ * @param to: ユーザ空間のバッファ(データをコピーする先)
  * 
  * @return 読み込んだバイト数
  */
-static ssize_t test_ioctl_read(struct file *file, char __user *buf,
-							   size_t count, loff_t *f_pos)
+static ssize_t test_ioctl_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	struct test_ioctl_data *ioctl_data = file->private_data;
+	struct test_ioctl_data *ioctl_data = iocb->ki_filp->private_data;
+	size_t count = iov_iter_count(to);
+	unsigned char *pattern = test_ioctl_get_pattern(ioctl_data);
+	size_t copied, n, done;
 	unsigned char val;
-	int retval;
-	int i = 0;
+	unsigned int seq;
+	ssize_t retval;
 
-	/* ロックをかけ, デバイスのvalを取得する */
-	read_lock(&ioctl_data->lock);
-	val = ioctl_data->val;
-	read_unlock(&ioctl_data->lock);
+	if (pattern == NULL) {
+		return -ENOMEM;
+	}
+
+retry:
+	seq = read_seqcount_begin(&ioctl_data->seq);
+	val = READ_ONCE(ioctl_data->val);
+	copied = 0;
 
 	/* ユーザプロセスにデータを渡す */
-	for (; i < count; i++) {
-		if (copy_to_user(&buf[i], &val, 1)) {
-			retval = -EFAULT;
-			goto out;
+	while (copied < count) {
+		n = min_t(size_t, count - copied, PAGE_SIZE);
+		done = test_ioctl_copy(pattern, n, to);
+		copied += done;
+
+		if (done != n) {
+			break;
 		}
 	}
 
-	retval = count;
-out:
+	/* 1回のreadの中では同じvalを返す */
+	if (read_seqcount_retry(&ioctl_data->seq, seq)) {
+		iov_iter_revert(to, copied);
+		goto retry;
+	}
+
+	retval = (copied == 0 && count) ? -EFAULT : copied;
+	trace_test_ioctl_read(ioctl_data, val, count, retval);
+
 	return retval;
 }
 
+/**
+ * @brief レジスタページを返す. 最初のmmap()のときに確保し, ioctl_numの反映先のリストに加える
+ * 
+ * mmap()しないオープンはリストに加えないので, open/closeでリストのロックを取らずに済む
+ * 
+ * @return レジスタページ. 確保できなければNULL
+ */
+static struct ioctl_regs *test_ioctl_get_regs(struct test_ioctl_data *ioctl_data) {
+	struct ioctl_regs *regs = smp_load_acquire(&ioctl_data->regs);
+
+	if (regs) {
+		return regs;
+	}
+
+	/* ページの残りが見えても困らないようにゼロで埋める */
+	regs = (struct ioctl_regs *)get_zeroed_page(GFP_KERNEL);
+
+	if (regs == NULL) {
+		return NULL;
+	}
+
+	/* リストに加えた後のioctl_numの変更は, test_ioctl_publish_num()がレジスタページに反映する */
+	spin_lock(&test_ioctl_list_lock);
+	write_lock(&ioctl_data->lock);
+	if (ioctl_data->regs) {
+		/* 別のスレッドが先に確保した */
+		write_unlock(&ioctl_data->lock);
+		spin_unlock(&test_ioctl_list_lock);
+		free_page((unsigned long)regs);
+		return ioctl_data->regs;
+	}
+	regs->val = ioctl_data->val;
+	list_add(&ioctl_data->node, &test_ioctl_list);
+
+	/*
+	 * リストに加えてからioctl_numを読む. test_ioctl_publish_num()のsmp_mb()と対になり,
+	 * 空のリストを見て反映を省いた更新も, ここで読む値には含まれる
+	 */
+	smp_mb();
+	regs->num = atomic64_read(&ioctl_num);
+	smp_store_release(&ioctl_data->regs, regs);
+	write_unlock(&ioctl_data->lock);
+	spin_unlock(&test_ioctl_list_lock);
+
+	return regs;
+}
+
+/**
+ * @brief mmap()されたとき, レジスタページを読み取り専用でマッピングする
+ * 
+ * ユーザ空間はシステムコールを使わずにvalとioctl_numを読み込める
+ * マッピングがページの参照を持つので, closeの後もマッピングが残っていてよい
+ */
+static int test_ioctl_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct test_ioctl_data *ioctl_data = file->private_data;
+	struct ioctl_regs *regs;
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE) {
+		return -EINVAL;
+	}
+
+	/* 書き込みできるマッピングは許さない. mprotect()で後から書き込み可能にもさせない */
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	regs = test_ioctl_get_regs(ioctl_data);
+
+	if (regs == NULL) {
+		return -ENOMEM;
+	}
+
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(regs));
+}
+
+/**
+ * @brief スラブキャッシュのコンストラクタ. オブジェクトが最初に作られたときだけ呼ばれる
+ * 
+ * データはロックを初期化した状態でキャッシュに返すので, open時の初期化は不要になる
+ */
+static void test_ioctl_data_ctor(void *obj) {
+	struct test_ioctl_data *ioctl_data = obj;
+
+	/* lockと, それに結び付けたシーケンスカウンタを初期化する */
+	rwlock_init(&ioctl_data->lock);
+	seqcount_rwlock_init(&ioctl_data->seq, &ioctl_data->lock);
+	ioctl_data->val = 0xFF;
+	ioctl_data->pattern = NULL;
+	ioctl_data->regs = NULL;
+	INIT_LIST_HEAD(&ioctl_data->node);
+}
+
 /**
  * @brief デバイスをcloseしたときに呼ばれる
  */
 static int test_ioctl_close(struct inode *inode, struct file *file) {
-	pr_alert("%s call.\n", __func__);
+	struct test_ioctl_data *ioctl_data = file->private_data;
+
+	if (log_calls) {
+		pr_alert("%s call.\n", __func__);
+	}
+	trace_test_ioctl_close(ioctl_data);
 
-	/* 確保したメモリを解放する */
-	if (file->private_data) {
-		kfree(file->private_data);
-		file->private_data = NULL;
+	/* mmap()されていたら, ioctl_numの反映先のリストから外す */
+	if (ioctl_data->regs) {
+		spin_lock(&test_ioctl_list_lock);
+		list_del_init(&ioctl_data->node);
+		spin_unlock(&test_ioctl_list_lock);
+
+		free_page((unsigned long)ioctl_data->regs);
+		ioctl_data->regs = NULL;
+	}
+
+	if (ioctl_data->pattern) {
+		free_page((unsigned long)ioctl_data->pattern);
+		ioctl_data->pattern = NULL;
 	}
 
+	/* コンストラクタ直後と同じ状態に戻してからキャッシュに返す */
+	ioctl_data->val = 0xFF;
+	kmem_cache_free(test_ioctl_cache, ioctl_data);
+	file->private_data = NULL;
+
 	return 0;
 }
 
+/**
+ * @brief マイナー番号の状態を返す. 最初のオープンのときに確保してxarrayに登録する
+ * 
+ * 登録済みならxa_load()でロックを取らずに引ける
+ * 
+ * @return マイナー番号の状態. 確保できなければNULL
+ */
+static struct test_ioctl_minor *test_ioctl_get_minor(unsigned int minor) {
+	struct test_ioctl_minor *minor_data, *old;
+
+	minor_data = xa_load(&test_ioctl_minors, minor);
+
+	if (minor_data) {
+		return minor_data;
+	}
+
+	minor_data = kmem_cache_zalloc(test_ioctl_minor_cache, GFP_KERNEL);
+
+	if (minor_data == NULL) {
+		return NULL;
+	}
+
+	minor_data->minor = minor;
+
+	/* 同時に最初のオープンが重なったら, 先に登録された方を使う */
+	old = xa_cmpxchg(&test_ioctl_minors, minor, NULL, minor_data, GFP_KERNEL);
+
+	if (old) {
+		kmem_cache_free(test_ioctl_minor_cache, minor_data);
+		return xa_is_err(old) ? NULL : old;
+	}
+
+	return minor_data;
+}
+
 /**
  * @brief ユーザがデバイスをopenしたときに呼ばれる
+ * 
+ * 専用のキャッシュから初期化済みのデータを取り出すだけなので, 短時間のopenとcloseを繰り返しても安い
+ * パターンとレジスタページは使われたときに確保する
  */
 static int test_ioctl_open(struct inode *inode, struct file *file) {
 	struct test_ioctl_data *ioctl_data;
+	struct test_ioctl_minor *minor_data;
+
+	if (log_calls) {
+		pr_alert("%s call.\n", __func__);
+	}
 
-	pr_alert("%s call.\n", __func__);
+	minor_data = test_ioctl_get_minor(iminor(inode));
 
-	/* メモリを確保し, デバイスのデータを初期化する */
-	ioctl_data = kmalloc(sizeof(struct test_ioctl_data), GFP_KERNEL);
+	if (minor_data == NULL) {
+		return -ENOMEM;
+	}
+
+	ioctl_data = kmem_cache_alloc(test_ioctl_cache, GFP_KERNEL);
 
 	if (ioctl_data == NULL) {
 		return -ENOMEM;
 	}
 
-	/* lockを初期化する */
-	rwlock_init(&ioctl_data->lock);
-	ioctl_data->val = 0xFF;
+	atomic64_inc(&minor_data->open_counter);
+	ioctl_data->minor = minor_data;
 
 	/* file->private_data内に保持する */
 	file->private_data = ioctl_data;
+	trace_test_ioctl_open(ioctl_data);
 
 	return 0;
 }
@@ -178,8 +815,12 @@ static struct file_operations fops = {
 #endif
 	.open = test_ioctl_open,
 	.release = test_ioctl_close,
-	.read = test_ioctl_read,
+	.read_iter = test_ioctl_read_iter,
 	.unlocked_ioctl = test_ioctl_ioctl,
+	.mmap = test_ioctl_mmap,
+#ifdef TEST_IOCTL_URING_CMD
+	.uring_cmd = test_ioctl_uring_cmd,
+#endif
 };
 
 /**
@@ -190,6 +831,35 @@ static int __init ioctl_init(void) {
 	int alloc_ret = -1;
 	int cdev_ret = -1;
 
+	if (num_of_dev == 0 || num_of_dev > TEST_IOCTL_MINORS_MAX) {
+		pr_alert("num_of_dev must be between 1 and %u\n", TEST_IOCTL_MINORS_MAX);
+		return -EINVAL;
+	}
+
+	/* オープンごとのデータを確保するキャッシュを作る. 別のデータとキャッシュラインを共有しないようにする */
+	test_ioctl_cache = kmem_cache_create("test_ioctl_data", sizeof(struct test_ioctl_data),
+										 0, SLAB_HWCACHE_ALIGN, test_ioctl_data_ctor);
+
+	if (test_ioctl_cache == NULL) {
+		return -ENOMEM;
+	}
+
+	/*
+	 * マイナー番号ごとの状態は小さいので, 詰めて配置する
+	 * 同じ大きさの別のキャッシュに統合されると/proc/slabinfoに現れないので, 統合を止める
+	 * SLAB_NO_MERGEがない古いカーネルでは, slab_nomergeを指定して起動する
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	test_ioctl_minor_cache = KMEM_CACHE(test_ioctl_minor, SLAB_NO_MERGE);
+#else
+	test_ioctl_minor_cache = KMEM_CACHE(test_ioctl_minor, 0);
+#endif
+
+	if (test_ioctl_minor_cache == NULL) {
+		kmem_cache_destroy(test_ioctl_cache);
+		return -ENOMEM;
+	}
+
 	/* 動的にメジャー番号を取得し, デバイスを登録 */
 	alloc_ret = alloc_chrdev_region(&dev, 0, num_of_dev, DRIVER_NAME);
 
@@ -209,6 +879,8 @@ static int __init ioctl_init(void) {
 	}
 
 	pr_alert("%s driver(major: %d) installed.\n", DRIVER_NAME, test_ioctl_major);
+	pr_info("%u minors, %zu bytes of state per opened minor\n",
+			num_of_dev, sizeof(struct test_ioctl_minor));
 	return 0;
 error:
 	if (cdev_ret == 0) {
@@ -217,9 +889,24 @@ error:
 	if (alloc_ret == 0) {
 		unregister_chrdev_region(dev, num_of_dev);
 	}
+	kmem_cache_destroy(test_ioctl_minor_cache);
+	kmem_cache_destroy(test_ioctl_cache);
 	return -1;
 }
 
+/**
+ * @brief 確保した全てのマイナー番号の状態を解放する
+ */
+static void test_ioctl_free_minors(void) {
+	struct test_ioctl_minor *minor_data;
+	unsigned long index;
+
+	xa_for_each(&test_ioctl_minors, index, minor_data) {
+		kmem_cache_free(test_ioctl_minor_cache, minor_data);
+	}
+	xa_destroy(&test_ioctl_minors);
+}
+
 /**
  * @brief モジュールの削除
  */
@@ -231,6 +918,10 @@ static void __exit ioctl_exit(void) {
 
 	/* メジャー番号を解放 */
 	unregister_chrdev_region(dev, num_of_dev);
+
+	test_ioctl_free_minors();
+	kmem_cache_destroy(test_ioctl_minor_cache);
+	kmem_cache_destroy(test_ioctl_cache);
 	pr_alert("%s driver removed.\n", DRIVER_NAME);
 }
 
@@ -11,42 +11,39 @@
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/ioctl.h>
+#include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/xarray.h>
 #include <linux/version.h>
 
-/**
- * @struct ioctl_arg
- * @brief ユーザ空間とカーネル空間の間でデータをやり取りするための構造体
- */
-struct ioctl_arg {
-	unsigned int val;
-};
+#include "test_ioctl.h"
 
 /**
- * @def ioctlコマンドを識別するためのマジックナンバー
- * \x66は, 他のデバイスとコマンドが衝突しないように設定する
+ * @def io_uringのIORING_OP_URING_CMDでコマンドを受け付けるかどうか(5.19以降)
  */
-#define IOC_MAGIC '\x66'
+#if defined(CONFIG_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#define TEST_IOCTL_URING_CMD
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#endif
 
 /**
- * ioctlコマンドの定義
- * _IOW(マジックナンバー, コマンド番号, データ型): ユーザ空間->カーネル空間へデータを送る
- * _IOR(マジックナンバー, コマンド番号, データ型): カーネル空間->ユーザ空間へデータを送る
+ * @def IOCTL_BATCHでユーザ空間から一度にコピーするコマンド数
  */
-#define IOCTL_VALSET _IOW(IOC_MAGIC, 0, struct ioctl_arg)
-
-#define IOCTL_VALGET _IOR(IOC_MAGIC, 1, struct ioctl_arg)
-
-#define IOCTL_VALGET_NUM _IOR(IOC_MAGIC, 2, int)
-
-#define IOCTL_VALSET_NUM _IOW(IOC_MAGIC, 3, int)
+#define IOCTL_BATCH_CHUNK 32
 
 /**
- * @def ioctlの最大コマンド番号を定義(0から3まで)
+ * @def 作成できるデバイス(マイナー番号)の最大数
  */
-#define IOCTL_VAL_MAXNR 3
+#define TEST_IOCTL_MINORS_MAX (MINORMASK + 1)
 
 /**
  * @def /dev/ioctltestのようにデバイスファイルの名前
@@ -59,8 +56,19 @@ extern unsigned int test_ioctl_major;
 //! 作成するデバイスの数
 extern unsigned int num_of_dev;
 
-//! 数値データのやり取りに使う変数
-extern int ioctl_num;
+//! 数値データのやり取りに使う変数. CASやFETCH_ADDで不可分に更新できるようにatomic64_tにする
+extern atomic64_t ioctl_num;
+
+/**
+ * @struct test_ioctl_minor
+ * @brief マイナー番号ごとの状態. 最初にオープンされたときに確保し, xarrayにマイナー番号で登録する
+ */
+struct test_ioctl_minor {
+	//! このマイナー番号がオープンされた回数
+	atomic64_t open_counter;
+	//! マイナー番号
+	unsigned int minor;
+};
 
 /**
  * @struct test_ioctl_data
@@ -69,8 +77,18 @@ extern int ioctl_num;
 struct test_ioctl_data {
 	//! デバイスの状態を保持する変数(ioctlやreadでアクセス可能)
 	unsigned char val;
-	//! データ競合を防ぐための排他制御ロック
+	//! オープンしたマイナー番号の状態
+	struct test_ioctl_minor *minor;
+	//! valで埋めた1ページ分のバッファ. readではここからページ単位でコピーする. 最初のreadで確保する
+	unsigned char *pattern;
+	//! mmap()で読み取り専用に公開するレジスタページ. 最初のmmap()で確保する
+	struct ioctl_regs *regs;
+	//! ioctl_numの変更をレジスタページに反映するための, mmap()されたデータのリスト
+	struct list_head node;
+	//! データ競合を防ぐための排他制御ロック. 書き込み側は常にこのロックで直列化する
 	rwlock_t lock;
+	//! ロックを取らずに読み込むためのシーケンスカウンタ. 書き込みのたびに進める
+	seqcount_rwlock_t seq;
 };
 
 #endif /* IOCTL_H */
\ No newline at end of file
@@ -0,0 +1,224 @@
+/**
+ * @file ioctl_atomic_bench.c
+ *
+ * 1つのファイルディスクリプタを共有する多数のスレッドから, デバイスのカウンタを1ずつ増やし,
+ * 1秒あたりの加算回数と失われた加算の数を計測する
+ *   get+set:   IOCTL_VALGET_NUMで読み, IOCTL_VALSET_NUMで書く(読み込みと書き込みの間で競合する)
+ *   fetch_add: IOCTL_NUM_FETCH_ADDで不可分に加える
+ *   cas:       IOCTL_NUM_CASで, 交換できるまで比較と交換を繰り返す
+ *   val_add:   IOCTL_VAL_FETCH_ADDでvalに加える(valは8ビットなので, 256で割った余りで確かめる)
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_atomic_bench [スレッドごとの加算回数] [最大スレッド数]
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+
+//! 全てのスレッドが共有するファイルディスクリプタ
+static int fd;
+
+//! スレッドごとの加算回数
+static long iterations;
+
+/**
+ * @brief 読み込みと書き込みを別のioctlで行う. 他のスレッドの加算を上書きすることがある
+ */
+static void *worker_get_set(void *arg) {
+	long i;
+	int num;
+
+	for (i = 0; i < iterations; i++) {
+		if (ioctl(fd, IOCTL_VALGET_NUM, &num) < 0 || ioctl(fd, IOCTL_VALSET_NUM, num + 1) < 0) {
+			perror("ioctl");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief IOCTL_NUM_FETCH_ADDで1ずつ加える
+ */
+static void *worker_fetch_add(void *arg) {
+	__s64 delta;
+	long i;
+
+	for (i = 0; i < iterations; i++) {
+		delta = 1;
+		if (ioctl(fd, IOCTL_NUM_FETCH_ADD, &delta) < 0) {
+			perror("ioctl");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief IOCTL_NUM_CASで, 読み込んだ値に1を加えた値へ交換できるまで繰り返す
+ */
+static void *worker_cas(void *arg) {
+	struct ioctl_cas cas = { .expected = 0 };
+	long i;
+	int ret;
+
+	for (i = 0; i < iterations; i++) {
+		do {
+			/* 失敗するとexpectedに現在の値が書き戻されるので, 読み直す必要はない */
+			cas.desired = cas.expected + 1;
+			ret = ioctl(fd, IOCTL_NUM_CAS, &cas);
+		} while (ret == 0);
+
+		if (ret < 0) {
+			perror("ioctl");
+			break;
+		}
+		cas.expected = cas.desired;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief IOCTL_VAL_FETCH_ADDでvalに1ずつ加える
+ */
+static void *worker_val_add(void *arg) {
+	__s64 delta;
+	long i;
+
+	for (i = 0; i < iterations; i++) {
+		delta = 1;
+		if (ioctl(fd, IOCTL_VAL_FETCH_ADD, &delta) < 0) {
+			perror("ioctl");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief ioctl_numを64ビットのまま読み込む(0を加えて, 加える前の値を受け取る)
+ */
+static __s64 read_num(void) {
+	__s64 num = 0;
+
+	ioctl(fd, IOCTL_NUM_FETCH_ADD, &num);
+	return num;
+}
+
+/**
+ * @brief valを読み込む
+ */
+static __s64 read_val(void) {
+	struct ioctl_arg data = { 0 };
+
+	ioctl(fd, IOCTL_VALGET, &data);
+	return data.val;
+}
+
+/**
+ * @brief カウンタを0にしてからnthreads個のスレッドで加算し, 結果を表示する
+ */
+static int run(const char *label, void *(*worker)(void *), int use_val, int nthreads) {
+	struct ioctl_arg zero = { .val = 0 };
+	struct timespec start, end;
+	pthread_t *threads;
+	__s64 expected, result;
+	double elapsed;
+	int i;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return -1;
+	}
+
+	if (ioctl(fd, IOCTL_VALSET_NUM, 0) < 0 || ioctl(fd, IOCTL_VALSET, &zero) < 0) {
+		perror("ioctl");
+		free(threads);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_create(&threads[i], NULL, worker, NULL);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	expected = (__s64)nthreads * iterations;
+	if (use_val) {
+		expected %= 256;
+		result = read_val();
+	} else {
+		result = read_num();
+	}
+
+	printf("%-10s %8d %16.0f %16lld %16lld\n", label, nthreads, nthreads * iterations / elapsed,
+		   (long long)expected, (long long)(expected - result));
+
+	free(threads);
+	return 0;
+}
+
+/**
+ * @brief 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する
+ */
+static int run_all(const char *label, void *(*worker)(void *), int use_val, int max_threads) {
+	int n;
+
+	for (n = 1; n < max_threads; n *= 2) {
+		if (run(label, worker, use_val, n)) {
+			return -1;
+		}
+	}
+
+	return run(label, worker, use_val, max_threads);
+}
+
+int main(int argc, char *argv[]) {
+	int max_threads, ret = 0;
+
+	iterations = argc > 1 ? atol(argv[1]) : 100000;
+	max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (iterations <= 0 || max_threads <= 0) {
+		printf("Usage: %s [iterations per thread] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	/* lostは期待した値と実際の値の差. 不可分なコマンドでは0になるはず */
+	printf("%-10s %8s %16s %16s %16s\n", "mode", "threads", "adds/s", "expected", "lost");
+
+	ret |= run_all("get+set", worker_get_set, 0, max_threads);
+	ret |= run_all("fetch_add", worker_fetch_add, 0, max_threads);
+	ret |= run_all("cas", worker_cas, 0, max_threads);
+	ret |= run_all("val_add", worker_val_add, 1, max_threads);
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
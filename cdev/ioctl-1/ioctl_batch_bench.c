@@ -0,0 +1,155 @@
+/**
+ * @file ioctl_batch_bench.c
+ *
+ * IOCTL_BATCHで1回のシステムコールにまとめるコマンド数を1から1024まで変え,
+ * 1秒あたりに実行できるコマンド数を計測する
+ * 比較のため, コマンドごとにioctl()を呼び出す場合も計測する
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_batch_bench [秒数]
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+
+static const unsigned int batch_sizes[] = { 1, 4, 16, 64, 256, 1024 };
+
+//! 計測で順に繰り返すコマンド
+static const unsigned int cmds[] = { IOCTL_VALSET, IOCTL_VALGET, IOCTL_VALSET_NUM, IOCTL_VALGET_NUM };
+
+#define NR_CMDS (sizeof(cmds) / sizeof(cmds[0]))
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief コマンドごとにioctl()を呼び出す
+ */
+static int run_single(int fd, double seconds) {
+	struct ioctl_arg data = { .val = 0x5A };
+	unsigned long ops = 0;
+	double start, elapsed;
+	int num, ret;
+
+	start = now();
+	do {
+		switch (cmds[ops % NR_CMDS]) {
+		case IOCTL_VALSET:
+			ret = ioctl(fd, IOCTL_VALSET, &data);
+			break;
+		case IOCTL_VALGET:
+			ret = ioctl(fd, IOCTL_VALGET, &data);
+			break;
+		case IOCTL_VALSET_NUM:
+			ret = ioctl(fd, IOCTL_VALSET_NUM, ops);
+			break;
+		default:
+			ret = ioctl(fd, IOCTL_VALGET_NUM, &num);
+			break;
+		}
+
+		if (ret < 0) {
+			perror("ioctl");
+			return -1;
+		}
+
+		ops++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-8s %8s %16.0f ops/s %16.0f syscalls/s\n", "single", "-", ops / elapsed, ops / elapsed);
+	return 0;
+}
+
+/**
+ * @brief nr個のコマンドをIOCTL_BATCHで1回のシステムコールにまとめて呼び出す
+ */
+static int run_batch(int fd, unsigned int nr, double seconds) {
+	struct ioctl_batch_entry *entries;
+	struct ioctl_batch batch;
+	unsigned long calls = 0;
+	double start, elapsed;
+	unsigned int i;
+
+	entries = calloc(nr, sizeof(*entries));
+	if (!entries) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		entries[i].cmd = cmds[i % NR_CMDS];
+		entries[i].arg = i & 0xFF;
+	}
+
+	batch.entries = (uintptr_t)entries;
+	batch.nr = nr;
+
+	start = now();
+	do {
+		if (ioctl(fd, IOCTL_BATCH, &batch) < 0 || batch.done != nr) {
+			perror("ioctl");
+			free(entries);
+			return -1;
+		}
+
+		calls++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	/* 書き戻された結果を確かめる */
+	for (i = 0; i < nr; i++) {
+		if (entries[i].result != 0) {
+			printf("entry %u failed: %d\n", i, entries[i].result);
+			free(entries);
+			return -1;
+		}
+	}
+
+	printf("%-8s %8u %16.0f ops/s %16.0f syscalls/s\n", "batch", nr,
+		   calls * nr / elapsed, calls / elapsed);
+
+	free(entries);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+	unsigned int i;
+	int fd, ret = 0;
+
+	if (seconds <= 0) {
+		printf("Usage: %s [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-8s %8s\n", "mode", "batch");
+
+	ret |= run_single(fd, seconds);
+
+	for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+		ret |= run_batch(fd, batch_sizes[i], seconds);
+	}
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
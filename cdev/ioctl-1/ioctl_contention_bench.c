@@ -0,0 +1,194 @@
+/**
+ * @file ioctl_contention_bench.c
+ *
+ * 1つのファイルディスクリプタを共有する多数のスレッドから, IOCTL_VALGETとIOCTL_VALSETを
+ * 指定した割合で呼び出し, 1秒あたりの呼び出し回数を計測する
+ * rwlockで読み込む場合(lockless_read=0)とシーケンスカウンタで読み込む場合(lockless_read=1)を比較する
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_contention_bench [書き込みの割合(%)] [秒数] [最大スレッド数]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+#define LOCKLESS_PARAM "/sys/module/ioctl_1/parameters/lockless_read"
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+//! 全てのスレッドが共有するファイルディスクリプタ
+static int fd;
+
+//! 呼び出しのうち書き込みにする割合(%)
+static int write_percent;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief lockless_readパラメータを書き換える
+ */
+static int set_lockless(int enable) {
+	FILE *fp = fopen(LOCKLESS_PARAM, "w");
+
+	if (!fp) {
+		perror(LOCKLESS_PARAM);
+		return -1;
+	}
+
+	fprintf(fp, "%d\n", enable);
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * @brief 指定したCPUに固定して, 読み込みと書き込みを決めた割合で繰り返す
+ */
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = arg;
+	unsigned int seed = t->cpu * 2654435761U + 1;
+	struct ioctl_arg data;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		/* xorshiftでスレッドごとに独立した乱数を作る */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		if ((int)(seed % 100) < write_percent) {
+			data.val = seed & 0xFF;
+			if (ioctl(fd, IOCTL_VALSET, &data) < 0) {
+				t->errors++;
+			} else {
+				t->writes++;
+			}
+		} else {
+			if (ioctl(fd, IOCTL_VALGET, &data) < 0) {
+				t->errors++;
+			} else {
+				t->reads++;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief nthreads個のスレッドで計測し, 結果を表示する
+ */
+static int run(const char *label, int nthreads, int seconds) {
+	struct bench_thread *threads;
+	struct timespec start, end;
+	unsigned long reads = 0, writes = 0, errors = 0;
+	double elapsed;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * nthreads);
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus };
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		reads += threads[i].reads;
+		writes += threads[i].writes;
+		errors += threads[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%-10s %8d %16.0f %16.0f %16.0f %10lu\n", label, nthreads,
+		   (reads + writes) / elapsed, reads / elapsed, writes / elapsed, errors);
+
+	free(threads);
+	return 0;
+}
+
+/**
+ * @brief 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する
+ */
+static int run_all(const char *label, int max_threads, int seconds) {
+	int n;
+
+	for (n = 1; n < max_threads; n *= 2) {
+		if (run(label, n, seconds)) {
+			return -1;
+		}
+	}
+
+	return run(label, max_threads, seconds);
+}
+
+int main(int argc, char *argv[]) {
+	int seconds, max_threads, ret = 0;
+
+	write_percent = argc > 1 ? atoi(argv[1]) : 1;
+	seconds = argc > 2 ? atoi(argv[2]) : 2;
+	max_threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (write_percent < 0 || write_percent > 100 || seconds <= 0 || max_threads <= 0) {
+		printf("Usage: %s [write %%] [seconds] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("write ratio: %d%%\n", write_percent);
+	printf("%-10s %8s %16s %16s %16s %10s\n", "reader", "threads", "ops/s", "reads/s", "writes/s", "errors");
+
+	if (set_lockless(0) == 0) {
+		ret |= run_all("rwlock", max_threads, seconds);
+	}
+
+	if (set_lockless(1) == 0) {
+		ret |= run_all("seqcount", max_threads, seconds);
+	}
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file ioctl_minor_bench.c
+ *
+ * num_of_devで多数のマイナー番号を作ったioctltestデバイスについて, open()の速度と
+ * マイナー番号ごとのメモリ使用量を計測する
+ *   first:  各マイナー番号の最初のopen()(状態を確保してxarrayに登録する)
+ *   again:  全てのマイナー番号をもう一度open()する(xarrayから引くだけ)
+ *   hot:    マイナー番号0だけを繰り返しopen()する
+ * メモリ使用量は/proc/slabinfoのtest_ioctl_minorキャッシュから求める
+ *
+ * デバイスファイルは指定したディレクトリ(省略すると/dev)の下の一時ディレクトリに作り, 終了時に削除する
+ * /tmpなどnodevでマウントされたファイルシステムでは, デバイスファイルを開けないので指定しない
+ * 使用例 -- sudo insmod ioctl-1.ko num_of_dev=65536
+ *          sudo ./ioctl_minor_bench [マイナー番号の数] [ディレクトリ]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_OF_DEV_PARAM "/sys/module/ioctl_1/parameters/num_of_dev"
+#define DRIVER_NAME "ioctltest"
+#define HOT_OPENS 100000
+#define DEFAULT_PARENT "/dev"
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief /proc/devicesからメジャー番号を探す. 見つからなければ-1を返す
+ */
+static int find_major(void) {
+	char line[128], name[64];
+	int major = -1, n;
+	FILE *fp = fopen("/proc/devices", "r");
+
+	if (!fp) {
+		perror("/proc/devices");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%d %63s", &n, name) == 2 && strcmp(name, DRIVER_NAME) == 0) {
+			major = n;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return major;
+}
+
+/**
+ * @brief モジュールパラメータからマイナー番号の数を読む
+ */
+static unsigned int read_num_of_dev(void) {
+	unsigned int num = 0;
+	FILE *fp = fopen(NUM_OF_DEV_PARAM, "r");
+
+	if (!fp) {
+		perror(NUM_OF_DEV_PARAM);
+		return 0;
+	}
+
+	if (fscanf(fp, "%u", &num) != 1) {
+		num = 0;
+	}
+
+	fclose(fp);
+	return num;
+}
+
+/**
+ * @brief /proc/slabinfoからtest_ioctl_minorキャッシュの使用バイト数を返す. 読めなければ-1を返す
+ */
+static long minor_slab_bytes(unsigned long *active) {
+	char line[512], name[64];
+	unsigned long active_objs, num_objs, objsize, objperslab, pagesperslab;
+	long bytes = -1;
+	FILE *fp = fopen("/proc/slabinfo", "r");
+
+	if (!fp) {
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %lu %lu %lu %lu %lu", name, &active_objs, &num_objs,
+				   &objsize, &objperslab, &pagesperslab) == 6 &&
+			strcmp(name, "test_ioctl_minor") == 0) {
+			*active = active_objs;
+			bytes = num_objs / objperslab * pagesperslab * sysconf(_SC_PAGESIZE);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return bytes;
+}
+
+/**
+ * @brief nr個のデバイスファイルを順にopen()/close()し, 1回あたりのナノ秒を返す
+ */
+static double open_all(const char *dir, unsigned int nr) {
+	char path[256];
+	double start;
+	unsigned int i;
+	int fd;
+
+	start = now();
+	for (i = 0; i < nr; i++) {
+		snprintf(path, sizeof(path), "%s/%u", dir, i);
+		fd = open(path, O_RDWR);
+		if (fd < 0) {
+			perror(path);
+			return -1;
+		}
+		close(fd);
+	}
+
+	return (now() - start) * 1e9 / nr;
+}
+
+/**
+ * @brief マイナー番号0だけをcount回open()/close()し, 1回あたりのナノ秒を返す
+ */
+static double open_hot(const char *dir, unsigned int count) {
+	char path[256];
+	double start;
+	unsigned int i;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/0", dir);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		fd = open(path, O_RDWR);
+		if (fd < 0) {
+			perror(path);
+			return -1;
+		}
+		close(fd);
+	}
+
+	return (now() - start) * 1e9 / count;
+}
+
+/**
+ * @brief 作ったデバイスファイルと一時ディレクトリを削除する
+ */
+static void remove_nodes(const char *dir, unsigned int nr) {
+	char path[256];
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		snprintf(path, sizeof(path), "%s/%u", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+	char dir[192];
+	char path[256];
+	unsigned long before_objs = 0, after_objs = 0;
+	long before_bytes, after_bytes;
+	double first, again, hot;
+	unsigned int nr, num_of_dev, i;
+	int major;
+
+	major = find_major();
+	num_of_dev = read_num_of_dev();
+	if (major < 0 || num_of_dev == 0) {
+		printf("%s is not loaded\n", DRIVER_NAME);
+		exit(EXIT_FAILURE);
+	}
+
+	nr = argc > 1 ? strtoul(argv[1], NULL, 0) : num_of_dev;
+	if (nr == 0 || nr > num_of_dev) {
+		printf("Usage: %s [1..%u] [directory]\n", argv[0], num_of_dev);
+		exit(EXIT_FAILURE);
+	}
+
+	if (snprintf(dir, sizeof(dir), "%s/ioctltest.XXXXXX", argc > 2 ? argv[2] : DEFAULT_PARENT) >= (int)sizeof(dir)) {
+		printf("directory name is too long\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < nr; i++) {
+		snprintf(path, sizeof(path), "%s/%u", dir, i);
+		if (mknod(path, S_IFCHR | 0600, makedev(major, i)) < 0) {
+			perror(path);
+			remove_nodes(dir, i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	before_bytes = minor_slab_bytes(&before_objs);
+
+	first = open_all(dir, nr);
+	again = open_all(dir, nr);
+	hot = open_hot(dir, HOT_OPENS);
+
+	after_bytes = minor_slab_bytes(&after_objs);
+
+	remove_nodes(dir, nr);
+
+	if (first < 0 || again < 0 || hot < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	printf("major %d, %u of %u minors\n", major, nr, num_of_dev);
+	printf("%-8s %12.0f ns/open\n", "first", first);
+	printf("%-8s %12.0f ns/open\n", "again", again);
+	printf("%-8s %12.0f ns/open\n", "hot", hot);
+
+	/* 前回の実行で確保済みのマイナー番号は, 今回は増えない */
+	if (before_bytes >= 0 && after_bytes >= 0) {
+		printf("slab: %lu -> %lu objects, %ld -> %ld bytes", before_objs, after_objs,
+			   before_bytes, after_bytes);
+		if (after_objs > before_objs) {
+			printf(" (%.1f bytes/minor)",
+				   (double)(after_bytes - before_bytes) / (after_objs - before_objs));
+		}
+		printf("\n");
+	} else {
+		printf("slab: /proc/slabinfo is not readable (before 6.5 the cache may be merged; boot with slab_nomerge)\n");
+	}
+
+	return 0;
+}
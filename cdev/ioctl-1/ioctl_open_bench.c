@@ -0,0 +1,140 @@
+/**
+ * @file ioctl_open_bench.c
+ *
+ * リクエストごとにデバイスを開くワーカーを想定して, ioctltestデバイスに対して
+ * open -> IOCTL_VALGET -> closeを繰り返し, 1秒あたりのオープン回数を計測する
+ * スレッド数を1から全コアまで増やしていき, open/closeがCPU数に対してスケールするかを確認する
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_open_bench [秒数] [最大スレッド数]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	unsigned long ops;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief 指定したCPUに固定して, open/ioctl/closeを繰り返す
+ */
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = arg;
+	struct ioctl_arg data;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		int fd = open(DEVICE_PATH, O_RDWR);
+
+		if (fd < 0) {
+			t->errors++;
+			continue;
+		}
+
+		if (ioctl(fd, IOCTL_VALGET, &data) < 0 || data.val != 0xFF) {
+			t->errors++;
+		} else {
+			t->ops++;
+		}
+
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief nthreads個のスレッドで計測し, 結果を表示する
+ */
+static int run(int nthreads, int seconds) {
+	struct bench_thread *threads;
+	struct timespec start, end;
+	unsigned long ops = 0, errors = 0;
+	double elapsed;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * nthreads);
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus };
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		errors += threads[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%8d %16.0f %16.0f %10lu\n", nthreads, ops / elapsed,
+		   ops / elapsed / nthreads, errors);
+
+	free(threads);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int n;
+
+	if (seconds <= 0 || max_threads <= 0) {
+		printf("Usage: %s [seconds] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%8s %16s %16s %10s\n", "threads", "opens/s", "opens/s/thread", "errors");
+
+	/* 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する */
+	for (n = 1; n < max_threads; n *= 2) {
+		if (run(n, seconds)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (run(max_threads, seconds)) {
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file ioctl_read_bench.c
+ *
+ * ioctltestデバイスのread()の速度を, 読み込みバッファのサイズを変えながら計測する
+ * 1バイトずつコピーする従来の方法(bulk_copy=0)とページ単位でコピーする方法(bulk_copy=1)を,
+ * read()とreadv()のそれぞれで比較し, GB/sを表示する
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_read_bench [readvの分割数]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/ioctltest"
+#define BULK_COPY_PARAM "/sys/module/ioctl_1/parameters/bulk_copy"
+
+//! 1回の計測で最低限読み込むバイト数
+#define MIN_TOTAL_BYTES (256UL << 20)
+
+//! 1回の計測にかける最長時間(秒)
+#define MAX_SECONDS 2.0
+
+static const size_t sizes[] = { 4UL << 10, 64UL << 10, 1UL << 20, 16UL << 20 };
+
+/**
+ * @brief bulk_copyパラメータを書き換える
+ */
+static int set_bulk_copy(int enable) {
+	FILE *fp = fopen(BULK_COPY_PARAM, "w");
+
+	if (!fp) {
+		perror(BULK_COPY_PARAM);
+		return -1;
+	}
+
+	fprintf(fp, "%d\n", enable);
+	fclose(fp);
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief sizeバイトずつの読み込みを繰り返し, 結果を表示する
+ *
+ * @param label 表示用の名前
+ * @param fd 読み込むデバイスファイル
+ * @param buffer 読み込み先のバッファ
+ * @param size 1回に読み込むバイト数
+ * @param niov 0ならread(), 1以上ならバッファをniov個に分けてreadv()を使う
+ */
+static int run(const char *label, int fd, char *buffer, size_t size, int niov) {
+	struct iovec *iov = NULL;
+	unsigned long bytes = 0;
+	double start, elapsed;
+	ssize_t ret;
+	int i;
+
+	if (niov) {
+		iov = calloc(niov, sizeof(*iov));
+		if (!iov) {
+			perror("calloc");
+			return -1;
+		}
+		for (i = 0; i < niov; i++) {
+			iov[i].iov_base = buffer + size / niov * i;
+			iov[i].iov_len = size / niov;
+		}
+	}
+
+	start = now();
+	do {
+		ret = niov ? readv(fd, iov, niov) : read(fd, buffer, size);
+		if (ret <= 0) {
+			perror("read");
+			free(iov);
+			return -1;
+		}
+		bytes += ret;
+		elapsed = now() - start;
+	} while (bytes < MIN_TOTAL_BYTES && elapsed < MAX_SECONDS);
+
+	printf("%-10s %-6s %10zu B %10.3f GB/s\n", label, niov ? "readv" : "read",
+		   size, bytes / elapsed / 1e9);
+
+	free(iov);
+	return 0;
+}
+
+/**
+ * @brief 全てのバッファサイズについて, read()とreadv()で計測する
+ */
+static int run_all(const char *label, int fd, char *buffer, int niov) {
+	unsigned int s;
+	int ret = 0;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		ret |= run(label, fd, buffer, sizes[s], 0);
+		if (sizes[s] >= (size_t)niov) {
+			ret |= run(label, fd, buffer, sizes[s], niov);
+		}
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	int niov = argc > 1 ? atoi(argv[1]) : 16;
+	char *buffer;
+	int fd, ret = 0;
+
+	if (niov <= 0) {
+		printf("Usage: %s [number of iovecs]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	buffer = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (!buffer) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		free(buffer);
+		exit(EXIT_FAILURE);
+	}
+
+	/* 従来の1バイトずつコピーする方法 */
+	if (set_bulk_copy(0) == 0) {
+		ret |= run_all("per-byte", fd, buffer, niov);
+	}
+
+	/* パターンのページからまとめてコピーする方法 */
+	if (set_bulk_copy(1) == 0) {
+		ret |= run_all("bulk", fd, buffer, niov);
+	}
+
+	close(fd);
+	free(buffer);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file ioctl_regs_bench.c
+ *
+ * valとioctl_numを読み込む速度を, 2通りの方法で比較する
+ *   ioctl: IOCTL_VALGETとIOCTL_VALGET_NUMを呼び出す(1回の読み込みに2回のシステムコール)
+ *   mmap:  mmap()したレジスタページからioctl_regs_read()で読み込む(システムコールなし)
+ * 初めに, ioctlで書き換えた値がレジスタページに反映されることを確かめる
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_regs_bench [秒数]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief ioctlで値を書き換え, レジスタページから同じ値が読めることを確かめる
+ */
+static int check(int fd, const struct ioctl_regs *regs) {
+	struct ioctl_arg data = { .val = 0x42 };
+	unsigned int val;
+	int num;
+
+	if (ioctl(fd, IOCTL_VALSET, &data) < 0 || ioctl(fd, IOCTL_VALSET_NUM, 1234) < 0) {
+		perror("ioctl");
+		return -1;
+	}
+
+	ioctl_regs_read(regs, &val, &num);
+	printf("mapped: val=0x%x num=%d\n", val, num);
+
+	if (val != 0x42 || num != 1234) {
+		printf("register page does not match\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+	struct ioctl_regs *regs;
+	struct ioctl_arg data;
+	unsigned long reads;
+	double start, elapsed;
+	unsigned int val;
+	int fd, num;
+
+	if (seconds <= 0) {
+		printf("Usage: %s [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	/* レジスタページは読み取り専用でしかマッピングできない */
+	regs = mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 0);
+	if (regs == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	if (check(fd, regs)) {
+		munmap(regs, 4096);
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	reads = 0;
+	start = now();
+	do {
+		if (ioctl(fd, IOCTL_VALGET, &data) < 0 || ioctl(fd, IOCTL_VALGET_NUM, &num) < 0) {
+			perror("ioctl");
+			munmap(regs, 4096);
+			close(fd);
+			exit(EXIT_FAILURE);
+		}
+		reads++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+	printf("%-6s %16.0f snapshots/s\n", "ioctl", reads / elapsed);
+
+	reads = 0;
+	start = now();
+	do {
+		/* 時刻の取得もvDSOなのでシステムコールは発生しない */
+		ioctl_regs_read(regs, &val, &num);
+		reads++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+	printf("%-6s %16.0f snapshots/s\n", "mmap", reads / elapsed);
+
+	munmap(regs, 4096);
+	close(fd);
+	return 0;
+}
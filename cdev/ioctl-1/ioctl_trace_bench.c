@@ -0,0 +1,132 @@
+/**
+ * @file ioctl_trace_bench.c
+ *
+ * ioctltestデバイスのIOCTL_VALSETとopen/closeの速度を, 記録の方法を変えて計測する
+ *   printk:     従来どおり呼び出しごとにpr_alertで出力する(log_calls=1)
+ *   tp-off:     トレースポイントのみで, トレーサは接続しない
+ *   tp-on:      ftraceでtest_ioctlのトレースポイントを有効にする
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_trace_bench [秒数]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+#define LOG_CALLS_PARAM "/sys/module/ioctl_1/parameters/log_calls"
+#define TRACE_ENABLE "/sys/kernel/tracing/events/test_ioctl/enable"
+#define TRACE_ENABLE_DEBUGFS "/sys/kernel/debug/tracing/events/test_ioctl/enable"
+
+/**
+ * @brief pathに数値を書き込む. 書き込めなければ-1を返す
+ */
+static int write_value(const char *path, int value, int quiet) {
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		if (!quiet) {
+			perror(path);
+		}
+		return -1;
+	}
+
+	fprintf(fp, "%d\n", value);
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * @brief test_ioctlのトレースポイントを有効または無効にする
+ */
+static int set_tracing(int enable) {
+	if (write_value(TRACE_ENABLE, enable, 1) == 0) {
+		return 0;
+	}
+	return write_value(TRACE_ENABLE_DEBUGFS, enable, 0);
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief IOCTL_VALSETとopen/closeの速度を計測し, 結果を表示する
+ */
+static int run(const char *label, double seconds) {
+	struct ioctl_arg data;
+	unsigned long sets = 0, opens = 0;
+	double start, set_elapsed, open_elapsed;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	start = now();
+	do {
+		data.val = sets & 0xFF;
+		if (ioctl(fd, IOCTL_VALSET, &data) < 0) {
+			perror("ioctl");
+			close(fd);
+			return -1;
+		}
+		sets++;
+		set_elapsed = now() - start;
+	} while (set_elapsed < seconds);
+
+	close(fd);
+
+	start = now();
+	do {
+		fd = open(DEVICE_PATH, O_RDWR);
+		if (fd < 0) {
+			perror("open");
+			return -1;
+		}
+		close(fd);
+		opens++;
+		open_elapsed = now() - start;
+	} while (open_elapsed < seconds);
+
+	printf("%-8s %16.0f %16.0f\n", label, sets / set_elapsed, opens / open_elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+	int ret = 0;
+
+	if (seconds <= 0) {
+		printf("Usage: %s [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-8s %16s %16s\n", "mode", "VALSET/s", "open+close/s");
+
+	/* 変更前と同じく, 呼び出しごとにカーネルログへ出力する */
+	if (write_value(LOG_CALLS_PARAM, 1, 0) == 0) {
+		ret |= run("printk", seconds);
+		write_value(LOG_CALLS_PARAM, 0, 0);
+	}
+
+	ret |= run("tp-off", seconds);
+
+	if (set_tracing(1) == 0) {
+		ret |= run("tp-on", seconds);
+		set_tracing(0);
+	}
+
+	return ret ? EXIT_FAILURE : 0;
+}
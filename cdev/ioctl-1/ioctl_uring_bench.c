@@ -0,0 +1,228 @@
+/**
+ * @file ioctl_uring_bench.c
+ *
+ * ioctltestデバイスのコマンドを, 同期的なioctl()とio_uringのIORING_OP_URING_CMDで
+ * 実行したときの1秒あたりのコマンド数を比較する
+ * io_uringでは深さ32のキューにVALSETとVALGETを交互に積み, 1回のio_uring_enter()で
+ * まとめて投入し, 全ての完了をまとめて回収する
+ * liburingは使わず, システムコールとリングのmmap()を直接使う
+ *
+ * デバイスファイルは自動では作られないので, 先に作っておく
+ * 使用例 -- sudo mknod /dev/ioctltest c <メジャー番号> 0
+ *          sudo ./ioctl_uring_bench [秒数]
+ */
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_ioctl.h"
+
+#define DEVICE_PATH "/dev/ioctltest"
+
+//! キューの深さ. 1回のio_uring_enter()で投入するコマンド数
+#define QUEUE_DEPTH 32
+
+/**
+ * @struct ring
+ * @brief mmap()した投入キューと完了キュー
+ */
+struct ring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief io_uringのインスタンスを作り, キューをマッピングする
+ */
+static int ring_init(struct ring *ring, unsigned int entries) {
+	struct io_uring_params p;
+	void *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		perror("io_uring_setup");
+		return -1;
+	}
+
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned int),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+					  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		perror("mmap");
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_head = sq + p.sq_off.head;
+	ring->sq_tail = sq + p.sq_off.tail;
+	ring->sq_mask = sq + p.sq_off.ring_mask;
+	ring->sq_array = sq + p.sq_off.array;
+	ring->cq_head = cq + p.cq_off.head;
+	ring->cq_tail = cq + p.cq_off.tail;
+	ring->cq_mask = cq + p.cq_off.ring_mask;
+	ring->cqes = cq + p.cq_off.cqes;
+
+	return 0;
+}
+
+/**
+ * @brief 投入キューにIORING_OP_URING_CMDを1つ積む
+ */
+static void ring_queue_cmd(struct ring *ring, int fd, unsigned int cmd, __u64 arg, __u64 user_data) {
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	struct ioctl_uring_cmd pdu = { .arg = arg };
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = fd;
+	sqe->cmd_op = cmd;
+	sqe->user_data = user_data;
+	memcpy(sqe->cmd, &pdu, sizeof(pdu));
+
+	ring->sq_array[index] = index;
+	atomic_store_explicit((_Atomic unsigned int *)ring->sq_tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief 完了キューから全ての完了を回収し, 失敗したコマンドの数を返す
+ */
+static int ring_reap(struct ring *ring, unsigned int *completed) {
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = atomic_load_explicit((_Atomic unsigned int *)ring->cq_tail, memory_order_acquire);
+	int errors = 0;
+
+	for (; head != tail; head++) {
+		if (ring->cqes[head & *ring->cq_mask].res < 0) {
+			errors++;
+		}
+		(*completed)++;
+	}
+
+	atomic_store_explicit((_Atomic unsigned int *)ring->cq_head, head, memory_order_release);
+	return errors;
+}
+
+/**
+ * @brief VALSETとVALGETを交互に, 1回ずつioctl()で呼び出す
+ */
+static int run_ioctl(int fd, double seconds) {
+	struct ioctl_arg data;
+	unsigned long ops = 0;
+	double start, elapsed;
+	int ret;
+
+	start = now();
+	do {
+		data.val = ops & 0xFF;
+		ret = ioctl(fd, ops & 1 ? IOCTL_VALGET : IOCTL_VALSET, &data);
+		if (ret < 0) {
+			perror("ioctl");
+			return -1;
+		}
+		ops++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-10s %8d %16.0f ops/s %16.0f syscalls/s\n", "ioctl", 1, ops / elapsed, ops / elapsed);
+	return 0;
+}
+
+/**
+ * @brief VALSETとVALGETを交互にQUEUE_DEPTH個積み, まとめて投入して完了を待つ
+ */
+static int run_uring(int fd, double seconds) {
+	struct ioctl_arg data[QUEUE_DEPTH];
+	unsigned long ops = 0, calls = 0;
+	double start, elapsed;
+	struct ring ring;
+	unsigned int i, completed;
+	int ret;
+
+	if (ring_init(&ring, QUEUE_DEPTH)) {
+		return -1;
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < QUEUE_DEPTH; i++) {
+			data[i].val = i;
+			ring_queue_cmd(&ring, fd, i & 1 ? IOCTL_VALGET : IOCTL_VALSET,
+						   (uintptr_t)&data[i], i);
+		}
+
+		/* 全てを投入し, 全ての完了を待つ */
+		ret = syscall(__NR_io_uring_enter, ring.fd, QUEUE_DEPTH, QUEUE_DEPTH,
+					  IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			perror("io_uring_enter");
+			close(ring.fd);
+			return -1;
+		}
+		calls++;
+
+		completed = 0;
+		if (ring_reap(&ring, &completed) || completed != QUEUE_DEPTH) {
+			printf("uring_cmd failed (is uring_cmd supported by the module?)\n");
+			close(ring.fd);
+			return -1;
+		}
+
+		ops += completed;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-10s %8d %16.0f ops/s %16.0f syscalls/s\n", "io_uring", QUEUE_DEPTH,
+		   ops / elapsed, calls / elapsed);
+
+	close(ring.fd);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+	int fd, ret = 0;
+
+	if (seconds <= 0) {
+		printf("Usage: %s [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-10s %8s\n", "mode", "depth");
+
+	ret |= run_ioctl(fd, seconds);
+	ret |= run_uring(fd, seconds);
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file test_ioctl.h
+ * 
+ * ioctltestデバイスのioctlコマンドを定義する. ユーザプログラムからもインクルードできる
+ */
+#ifndef TEST_IOCTL_H
+#define TEST_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * @struct ioctl_arg
+ * @brief ユーザ空間とカーネル空間の間でデータをやり取りするための構造体
+ */
+struct ioctl_arg {
+	unsigned int val;
+};
+
+/**
+ * @def ioctlコマンドを識別するためのマジックナンバー
+ * \x66は, 他のデバイスとコマンドが衝突しないように設定する
+ */
+#define IOC_MAGIC '\x66'
+
+/**
+ * ioctlコマンドの定義
+ * _IOW(マジックナンバー, コマンド番号, データ型): ユーザ空間->カーネル空間へデータを送る
+ * _IOR(マジックナンバー, コマンド番号, データ型): カーネル空間->ユーザ空間へデータを送る
+ */
+#define IOCTL_VALSET _IOW(IOC_MAGIC, 0, struct ioctl_arg)
+
+#define IOCTL_VALGET _IOR(IOC_MAGIC, 1, struct ioctl_arg)
+
+#define IOCTL_VALGET_NUM _IOR(IOC_MAGIC, 2, int)
+
+#define IOCTL_VALSET_NUM _IOW(IOC_MAGIC, 3, int)
+
+/**
+ * @struct ioctl_batch_entry
+ * @brief IOCTL_BATCHで実行する1つのコマンド
+ */
+struct ioctl_batch_entry {
+	//! 実行するコマンド(IOCTL_VALSET, IOCTL_VALGET, IOCTL_VALGET_NUM, IOCTL_VALSET_NUM,
+	//! IOCTL_NUM_FETCH_ADD, IOCTL_VAL_FETCH_ADD). 引数が2つあるCASは使えない
+	__u32 cmd;
+	//! コマンドの結果. 成功なら0, 失敗なら負のエラー番号が書き戻される
+	__s32 result;
+	//! SETのコマンドでは設定する値, GETのコマンドでは取得した値が書き戻される
+	//! FETCH_ADDでは加える値を渡し, 加える前の値が書き戻される
+	__u64 arg;
+};
+
+/**
+ * @struct ioctl_batch
+ * @brief IOCTL_BATCHに渡す, コマンドの配列の情報
+ */
+struct ioctl_batch {
+	//! struct ioctl_batch_entryの配列へのポインタ
+	__u64 entries;
+	//! 配列の要素数(IOCTL_BATCH_MAXまで)
+	__u32 nr;
+	//! 実行し, 結果を書き戻した要素数が書き戻される
+	__u32 done;
+};
+
+/**
+ * @def 1回のIOCTL_BATCHで実行できる最大のコマンド数
+ */
+#define IOCTL_BATCH_MAX 1024
+
+/**
+ * 複数のコマンドを1回のシステムコールで順に実行する
+ * 途中のコマンドが失敗しても残りのコマンドは実行し, それぞれの結果をresultに書き戻す
+ */
+#define IOCTL_BATCH _IOWR(IOC_MAGIC, 4, struct ioctl_batch)
+
+/**
+ * @struct ioctl_uring_cmd
+ * @brief io_uringのIORING_OP_URING_CMDでSQEのコマンド領域に置く引数
+ * 
+ * sqe->cmd_opにioctlのコマンド番号を入れ, argにはioctl()の第3引数と同じもの
+ * (値またはユーザ空間のポインタ)を入れる. 結果はCQEのresに返る
+ */
+struct ioctl_uring_cmd {
+	__u64 arg;
+};
+
+/**
+ * @struct ioctl_regs
+ * @brief mmap()で読み取り専用に公開するレジスタページの内容
+ * 
+ * カーネルは更新の前後でseqを1ずつ進めるので, 更新中はseqが奇数になる
+ * ユーザ空間はioctl_regs_read()でシステムコールを使わずに一貫した値を読み込める
+ */
+struct ioctl_regs {
+	//! シーケンスカウンタ. 奇数なら更新中
+	__u32 seq;
+	//! このオープンのval
+	__u32 val;
+	//! ioctl_num
+	__s32 num;
+};
+
+#ifndef __KERNEL__
+/**
+ * @brief mmap()したレジスタページから, valとioctl_numを一貫した組として読み込む
+ * 
+ * seqが奇数の間は待ち, 読み込みの前後でseqが変わっていたら読み直す
+ */
+static inline void ioctl_regs_read(const struct ioctl_regs *regs, unsigned int *val, int *num) {
+	__u32 seq;
+
+	do {
+		while ((seq = __atomic_load_n(&regs->seq, __ATOMIC_ACQUIRE)) & 1) {
+			;
+		}
+		*val = __atomic_load_n(&regs->val, __ATOMIC_RELAXED);
+		*num = __atomic_load_n(&regs->num, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&regs->seq, __ATOMIC_RELAXED) != seq);
+}
+#endif
+
+/**
+ * @struct ioctl_cas
+ * @brief IOCTL_NUM_CASとIOCTL_VAL_CASに渡す引数
+ */
+struct ioctl_cas {
+	//! 期待する現在の値. 交換できたかどうかにかかわらず, 実行時の値が書き戻される
+	__s64 expected;
+	//! 現在の値がexpectedと等しいときに書き込む値
+	__s64 desired;
+};
+
+/**
+ * 読み込み, 変更, 書き込みを不可分に行うコマンド
+ * CASは交換できたら1, 値が異なり交換しなかったら0を返し, どちらの場合もexpectedに実行時の値を書き戻す
+ * FETCH_ADDは渡した値を加え, 加える前の値を同じ場所に書き戻す
+ * ioctl_numは64ビットで演算する(IOCTL_VALGET_NUMとレジスタページは下位32ビットを返す)
+ * valは8ビットなので, expectedとdesiredは下位8ビットで比較, 書き込みし, 加算は256で循環する
+ */
+#define IOCTL_NUM_CAS _IOWR(IOC_MAGIC, 5, struct ioctl_cas)
+
+#define IOCTL_NUM_FETCH_ADD _IOWR(IOC_MAGIC, 6, __s64)
+
+#define IOCTL_VAL_CAS _IOWR(IOC_MAGIC, 7, struct ioctl_cas)
+
+#define IOCTL_VAL_FETCH_ADD _IOWR(IOC_MAGIC, 8, __s64)
+
+/**
+ * @def ioctlの最大コマンド番号を定義(0から8まで)
+ */
+#define IOCTL_VAL_MAXNR 8
+
+#endif /* TEST_IOCTL_H */
\ No newline at end of file
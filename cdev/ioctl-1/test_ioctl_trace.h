@@ -0,0 +1,134 @@
+/**
+ * @file test_ioctl_trace.h
+ *
+ * ioctltestデバイスのトレースポイントを定義する
+ * トレーサが接続されていないときはほぼコストがかからず, ftraceやperfから必要なときに有効にできる
+ * 例 -- echo 1 > /sys/kernel/tracing/events/test_ioctl/enable
+ *       perf record -e 'test_ioctl:*' ...
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM test_ioctl
+
+#if !defined(TEST_IOCTL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define TEST_IOCTL_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * オープンとクローズで共通のイベントの形式. どのオープンかをデータのアドレスで区別する
+ */
+DECLARE_EVENT_CLASS(test_ioctl_file,
+
+	TP_PROTO(const void *data),
+
+	TP_ARGS(data),
+
+	TP_STRUCT__entry(
+		__field(const void *, data)
+	),
+
+	TP_fast_assign(
+		__entry->data = data;
+	),
+
+	TP_printk("data=%p", __entry->data)
+);
+
+/**
+ * デバイスがopenされたとき
+ */
+DEFINE_EVENT(test_ioctl_file, test_ioctl_open,
+
+	TP_PROTO(const void *data),
+
+	TP_ARGS(data)
+);
+
+/**
+ * デバイスがcloseされたとき
+ */
+DEFINE_EVENT(test_ioctl_file, test_ioctl_close,
+
+	TP_PROTO(const void *data),
+
+	TP_ARGS(data)
+);
+
+/**
+ * valの読み書きで共通のイベントの形式
+ */
+DECLARE_EVENT_CLASS(test_ioctl_val,
+
+	TP_PROTO(const void *data, unsigned char val),
+
+	TP_ARGS(data, val),
+
+	TP_STRUCT__entry(
+		__field(const void *, data)
+		__field(unsigned char, val)
+	),
+
+	TP_fast_assign(
+		__entry->data = data;
+		__entry->val = val;
+	),
+
+	TP_printk("data=%p val=0x%x", __entry->data, __entry->val)
+);
+
+/**
+ * IOCTL_VALSETでvalが設定されたとき(IOCTL_BATCHの中のものも含む)
+ */
+DEFINE_EVENT(test_ioctl_val, test_ioctl_set,
+
+	TP_PROTO(const void *data, unsigned char val),
+
+	TP_ARGS(data, val)
+);
+
+/**
+ * IOCTL_VALGETでvalが取得されたとき(IOCTL_BATCHの中のものも含む)
+ */
+DEFINE_EVENT(test_ioctl_val, test_ioctl_get,
+
+	TP_PROTO(const void *data, unsigned char val),
+
+	TP_ARGS(data, val)
+);
+
+/**
+ * readでvalが読み込まれたとき
+ */
+TRACE_EVENT(test_ioctl_read,
+
+	TP_PROTO(const void *data, unsigned char val, size_t count, ssize_t ret),
+
+	TP_ARGS(data, val, count, ret),
+
+	TP_STRUCT__entry(
+		__field(const void *, data)
+		__field(unsigned char, val)
+		__field(size_t, count)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->data = data;
+		__entry->val = val;
+		__entry->count = count;
+		__entry->ret = ret;
+	),
+
+	TP_printk("data=%p val=0x%x count=%zu ret=%zd",
+			  __entry->data, __entry->val, __entry->count, __entry->ret)
+);
+
+#endif /* TEST_IOCTL_TRACE_H */
+
+/* モジュールのディレクトリにあるヘッダなので, define_trace.hに場所を教える */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE test_ioctl_trace
+
+#include <trace/define_trace.h>
\ No newline at end of file
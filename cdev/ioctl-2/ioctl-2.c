@@ -3,14 +3,20 @@
  * 
  * キャラクタデバイスドライバを実装して, ioctlを用いたメッセージのやり取りができる
  */
-#include <linux/atomic.h>
 #include <linux/cdev.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/jhash.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/printk.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/slab.h>
+#include <linux/srcu.h>
+#include <linux/string.h>
 #include <linux/types.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
@@ -21,21 +27,104 @@
 #include "ioctl-2.h"
 
 #define SUCCESS 0
-#define BUF_LEN 80
+#define BUF_LEN (MSG_BUF_LEN - 1)
 
 /**
- * @enum 排他制御のための列挙体
+ * @struct device_message
+ * @brief デバイス内のメッセージ. 書き換えるときは新しいものを確保して差し替える
  */
-enum {
-	CDEV_NOT_USED,
-	CDEV_EXCLUSIVE_OPEN,
+struct device_message {
+	//! 読み込み中のスレッドがいなくなってから解放するために使う
+	struct rcu_head rcu;
+	//! メッセージの長さ('\0'を含まない)
+	size_t len;
+	//! メッセージを格納するMSG_BUF_LENバイトのバッファ('\0'で終わる)
+	char *data;
 };
 
-//! デバイスの排他制御を行う(初期状態は未使用)
-static atomic_t already_open = ATOMIC_INIT(CDEV_NOT_USED);
+/**
+ * 現在のメッセージ. 読み込み側はロックを取らずにmessage_srcuの中で参照する
+ * copy_to_user()はページフォルトで眠ることがあるので, 読み込み中に眠れるSRCUを使う
+ */
+static struct device_message __rcu *message;
+
+//! messageの差し替えを直列化する
+static DEFINE_MUTEX(message_lock);
+
+//! messageとstoreのエントリの読み込み側を保護する
+DEFINE_STATIC_SRCU(message_srcu);
+
+/**
+ * @struct device_entry
+ * @brief キーと値を格納するstoreのエントリ. 値を置き換えるときは新しいエントリと差し替える
+ */
+struct device_entry {
+	//! storeのハッシュチェーンにつなぐ
+	struct rhash_head node;
+	//! 読み込み中のスレッドがいなくなってから解放するために使う
+	struct rcu_head rcu;
+	//! キーの長さ
+	u32 key_len;
+	//! 値の長さ
+	u32 value_len;
+	//! キー(key_lenバイト)の後に値(value_lenバイト)が続く
+	char data[];
+};
+
+/**
+ * @struct device_key
+ * @brief storeを検索するときのキー
+ */
+struct device_key {
+	const char *data;
+	u32 len;
+};
+
+/**
+ * @brief 検索するキーのハッシュ値を求める
+ */
+static u32 device_key_hashfn(const void *data, u32 len, u32 seed) {
+	const struct device_key *key = data;
+
+	return jhash(key->data, key->len, seed);
+}
+
+/**
+ * @brief エントリのキーのハッシュ値を求める. device_key_hashfn()と同じ値になる
+ */
+static u32 device_entry_hashfn(const void *data, u32 len, u32 seed) {
+	const struct device_entry *entry = data;
 
-//! デバイス内のメッセージを格納するバッファ
-static char message[BUF_LEN + 1];
+	return jhash(entry->data, entry->key_len, seed);
+}
+
+/**
+ * @brief エントリのキーが検索するキーと一致すれば0を返す
+ */
+static int device_entry_cmpfn(struct rhashtable_compare_arg *arg, const void *obj) {
+	const struct device_key *key = arg->key;
+	const struct device_entry *entry = obj;
+
+	return entry->key_len != key->len || memcmp(entry->data, key->data, key->len);
+}
+
+//! キーが可変長なので, ハッシュと比較は専用の関数で行う
+static const struct rhashtable_params store_params = {
+	.head_offset = offsetof(struct device_entry, node),
+	.hashfn = device_key_hashfn,
+	.obj_hashfn = device_entry_hashfn,
+	.obj_cmpfn = device_entry_cmpfn,
+	.automatic_shrinking = true,
+};
+
+/**
+ * キーと値を格納するハッシュテーブル. 検索はmessage_srcuの中でロックを取らずに行い,
+ * エントリの追加, 置き換え, 削除はstore_lockで直列化する
+ */
+static struct rhashtable store;
+
+//! storeの書き込み側を直列化する
+static DEFINE_MUTEX(store_lock);
 
 //! デバイスのクラスに使用
 static struct class *cls;
@@ -64,6 +153,62 @@ static int device_release(struct inode *inode, struct file *file) {
 	return SUCCESS;
 }
 
+/**
+ * @brief 空のメッセージを確保する
+ * 
+ * バッファはMSG_BUF_LENバイトまとめて確保し, ユーザ空間から長さを調べずに直接コピーできるようにする
+ */
+static struct device_message *device_message_alloc(void) {
+	struct device_message *msg = kmalloc(sizeof(*msg), GFP_KERNEL);
+
+	if (msg == NULL) {
+		return NULL;
+	}
+
+	msg->data = kmalloc(MSG_BUF_LEN, GFP_KERNEL);
+
+	if (msg->data == NULL) {
+		kfree(msg);
+		return NULL;
+	}
+
+	msg->data[0] = '\0';
+	msg->len = 0;
+
+	return msg;
+}
+
+/**
+ * @brief メッセージをすぐに解放する. 公開していないメッセージにだけ使う
+ */
+static void device_message_destroy(struct device_message *msg) {
+	kfree(msg->data);
+	kfree(msg);
+}
+
+/**
+ * @brief 読み込み側がいなくなった古いメッセージを解放する
+ */
+static void device_message_free(struct rcu_head *rcu) {
+	device_message_destroy(container_of(rcu, struct device_message, rcu));
+}
+
+/**
+ * @brief 新しいメッセージを公開し, 古いメッセージは読み込み中のスレッドがいなくなってから解放する
+ * 
+ * 読み込み側は差し替えの前後どちらかのメッセージを最後まで読むので, 待たされることも壊れた内容を読むこともない
+ */
+static void device_publish(struct device_message *msg) {
+	struct device_message *old;
+
+	mutex_lock(&message_lock);
+	old = rcu_replace_pointer(message, msg, lockdep_is_held(&message_lock));
+	mutex_unlock(&message_lock);
+
+	/* 書き込み側を待たせないように, 解放は猶予期間の後にまとめて行う */
+	call_srcu(&message_srcu, &old->rcu, device_message_free);
+}
+
 /**
  * @brief read()が呼び出されたときの処理
  */
@@ -71,35 +216,37 @@ static ssize_t device_read(struct file *file, char __user *buffer,
 						   size_t length, loff_t *offset)
 {
 	/* バッファに書き込まれたバイト数 */
-	int bytes_read = 0;
+	size_t bytes_read;
+	struct device_message *msg;
+	int idx;
 
-	/* messageのポインタを取得する */
-	const char *message_ptr = message;
+	/* 読み込みの間, 差し替えられたメッセージも解放されない */
+	idx = srcu_read_lock(&message_srcu);
+	msg = srcu_dereference(message, &message_srcu);
 
 	/**
 	 * データの終端チェック
-	 * *offset位置のデータがNULLなら, 読み取り終了(0を返す)
+	 * *offsetがメッセージの終端に達していたら, 読み取り終了(0を返す)
 	 * *offset = 0; でオフセットをリセット
 	 */
-	if (!*(message_ptr + *offset)) {
+	if (*offset < 0 || *offset >= msg->len) {
+		srcu_read_unlock(&message_srcu, idx);
 		*offset = 0;
 		return 0;
 	}
 
-	message_ptr += *offset;
+	/* offset位置からbufferへ, lengthバイト or messageの終端までまとめてコピー */
+	bytes_read = min_t(size_t, length, msg->len - *offset);
 
-	/**
-	 * offset位置からbufferへデータをコピー
-	 * lengthバイト or messageの終端まで繰り返し
-	 */
-	while (length && *message_ptr) {
-		/* put_userでユーザ空間へ1バイトずつコピーする */
-		put_user(*(message_ptr++), buffer++);
-		length--;
-		bytes_read++;
+	if (copy_to_user(buffer, msg->data + *offset, bytes_read)) {
+		srcu_read_unlock(&message_srcu, idx);
+		return -EFAULT;
 	}
 
-	pr_info("Read %d bytes, %ld left\n", bytes_read, length);
+	srcu_read_unlock(&message_srcu, idx);
+
+	/* 並列に読み込むスレッドがコンソールのロックで詰まらないように, 通常は出力しない */
+	pr_debug("Read %zu bytes, %zu left\n", bytes_read, length - bytes_read);
 
 	/* オフセットを更新 */
 	*offset += bytes_read;
@@ -113,19 +260,283 @@ static ssize_t device_read(struct file *file, char __user *buffer,
 static ssize_t device_write(struct file *file, const char __user *buffer,
 							size_t length, loff_t *offset)
 {
-	int i;
+	struct device_message *msg;
+	size_t n = min_t(size_t, length, BUF_LEN);
+
+	pr_debug("device_write(%p,%p,%ld)", file, buffer, length);
 
-	pr_info("device_write(%p,%p,%ld)", file, buffer, length);
+	/* 読み込み中のスレッドに書きかけの内容を見せないように, 新しいバッファに書いてから差し替える */
+	msg = device_message_alloc();
 
-	/* ユーザ空間のbufferからmessageにデータをコピー */
-	for (i = 0; i < length && i < BUF_LEN; i++) {
-		/* ユーザ空間のデータをカーネル空間へコピー */
-		get_user(message[i], buffer + i);
+	if (msg == NULL) {
+		return -ENOMEM;
 	}
 
+	/* ユーザ空間のbufferからmessageにBUF_LENバイトまでまとめてコピー */
+	if (copy_from_user(msg->data, buffer, n)) {
+		device_message_destroy(msg);
+		return -EFAULT;
+	}
+
+	msg->data[n] = '\0';
+	msg->len = strnlen(msg->data, n);
+
+	device_publish(msg);
+
+	/*
+	 * 収まらなかった分は捨てるが, 全て書き込んだことにする
+	 * 短い数を返すとwrite()を繰り返す呼び出し側が残りを送り直し, メッセージが残りで置き換わってしまう
+	 */
+	return length;
+}
+
+/**
+ * @brief ユーザ空間の文字列を1回のstrncpy_from_user()で新しいメッセージにコピーして公開する
+ * 
+ * 長さを調べるための読み込みとコピーを分けず, '\0'までを一度だけ読む
+ * 
+ * @return メッセージの長さ. MSG_BUF_LENに収まらなければ-E2BIG
+ */
+static long device_set_msg(const char __user *str) {
+	struct device_message *msg;
+	long len;
+
+	msg = device_message_alloc();
+
+	if (msg == NULL) {
+		return -ENOMEM;
+	}
+
+	len = strncpy_from_user(msg->data, str, MSG_BUF_LEN);
+
+	/* MSG_BUF_LENバイト読んでも'\0'がなければ, 終端を格納できない */
+	if (len < 0 || len == MSG_BUF_LEN) {
+		device_message_destroy(msg);
+		return len < 0 ? len : -E2BIG;
+	}
+
+	msg->len = len;
+	device_publish(msg);
+
+	return len;
+}
+
+/**
+ * @brief メッセージのrange->offsetバイト目から最大range->lenバイトをユーザ空間へコピーする
+ * 
+ * @return コピーしたバイト数. 範囲外なら-EINVAL, コピーに失敗したら-EFAULT
+ */
+static long device_get_range(const struct ioctl_range *range) {
+	struct device_message *msg;
+	size_t len, n;
+	long ret;
+	int idx;
+
+	idx = srcu_read_lock(&message_srcu);
+	msg = srcu_dereference(message, &message_srcu);
+	len = msg->len;
+
+	if (range->offset > len) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	n = min_t(size_t, range->len, len - range->offset);
+
+	if (copy_to_user(u64_to_user_ptr(range->buf), msg->data + range->offset, n)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = n;
+out:
+	srcu_read_unlock(&message_srcu, idx);
+	return ret;
+}
+
+/**
+ * @brief メッセージのnバイト目を返す
+ * 
+ * @return nバイト目の値(0から255). 範囲外なら-EINVAL
+ */
+static long device_get_nth_byte(unsigned long n) {
+	struct device_message *msg;
+	long ret;
+	int idx;
+
+	/* バッファの外は読まない */
+	if (n > BUF_LEN) {
+		return -EINVAL;
+	}
+
+	/* バッファのメッセージより後ろは初期化していないので, 終端以降は0を返す */
+	idx = srcu_read_lock(&message_srcu);
+	msg = srcu_dereference(message, &message_srcu);
+	/* charのままだと0x80以上のバイトが負になり, エラーの値と区別できない */
+	ret = n < msg->len ? (unsigned char)msg->data[n] : 0;
+	srcu_read_unlock(&message_srcu, idx);
+
+	return ret;
+}
+
+/**
+ * @brief 読み込み側がいなくなった古いエントリを解放する
+ */
+static void device_entry_free(struct rcu_head *rcu) {
+	kfree(container_of(rcu, struct device_entry, rcu));
+}
+
+/**
+ * @brief ユーザ空間からキーをbufにコピーする
+ * 
+ * @return 0なら成功. キーの長さが範囲外なら-EINVAL
+ */
+static int device_copy_key(const struct ioctl_kv *kv, char *buf, struct device_key *key) {
+	if (kv->key_len == 0 || kv->key_len > KV_KEY_MAX) {
+		return -EINVAL;
+	}
+
+	if (copy_from_user(buf, u64_to_user_ptr(kv->key), kv->key_len)) {
+		return -EFAULT;
+	}
+
+	key->data = buf;
+	key->len = kv->key_len;
+
 	return 0;
 }
 
+/**
+ * @brief キーに値を格納する. 既にキーがあれば, 新しいエントリと差し替える
+ * 
+ * 検索中のスレッドは差し替えの前後どちらかのエントリを最後まで読むので, 待たされることはない
+ */
+static long device_kv_put(const struct ioctl_kv *kv) {
+	struct device_entry *entry, *old;
+	struct device_key key;
+	int ret;
+
+	if (kv->key_len == 0 || kv->key_len > KV_KEY_MAX || kv->value_len > MSG_BUF_LEN) {
+		return -EINVAL;
+	}
+
+	/* キーと値を1つのエントリにまとめて確保し, ロックを取る前にコピーしておく */
+	entry = kmalloc(struct_size(entry, data, kv->key_len + kv->value_len), GFP_KERNEL);
+
+	if (entry == NULL) {
+		return -ENOMEM;
+	}
+
+	entry->key_len = kv->key_len;
+	entry->value_len = kv->value_len;
+
+	if (copy_from_user(entry->data, u64_to_user_ptr(kv->key), kv->key_len) ||
+		copy_from_user(entry->data + kv->key_len, u64_to_user_ptr(kv->value), kv->value_len)) {
+		kfree(entry);
+		return -EFAULT;
+	}
+
+	key.data = entry->data;
+	key.len = entry->key_len;
+
+	mutex_lock(&store_lock);
+	old = rhashtable_lookup_fast(&store, &key, store_params);
+
+	if (old) {
+		ret = rhashtable_replace_fast(&store, &old->node, &entry->node, store_params);
+	} else {
+		ret = rhashtable_insert_fast(&store, &entry->node, store_params);
+	}
+	mutex_unlock(&store_lock);
+
+	if (ret) {
+		kfree(entry);
+		return ret;
+	}
+
+	if (old) {
+		call_srcu(&message_srcu, &old->rcu, device_entry_free);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief キーの値をユーザ空間へコピーする. ロックを取らずに, 他の検索や書き込みと並列に実行できる
+ * 
+ * @return 値全体の長さ. キーがなければ-ENOENT
+ */
+static long device_kv_get(const struct ioctl_kv *kv) {
+	struct device_entry *entry;
+	struct device_key key;
+	char buf[KV_KEY_MAX];
+	long ret;
+	int idx;
+
+	ret = device_copy_key(kv, buf, &key);
+
+	if (ret) {
+		return ret;
+	}
+
+	/* 値をコピーし終えるまで, 置き換えや削除をされたエントリも解放されない */
+	idx = srcu_read_lock(&message_srcu);
+	entry = rhashtable_lookup_fast(&store, &key, store_params);
+
+	if (entry == NULL) {
+		ret = -ENOENT;
+	} else if (copy_to_user(u64_to_user_ptr(kv->value), entry->data + entry->key_len,
+							min(kv->value_len, entry->value_len))) {
+		ret = -EFAULT;
+	} else {
+		ret = entry->value_len;
+	}
+	srcu_read_unlock(&message_srcu, idx);
+
+	return ret;
+}
+
+/**
+ * @brief キーを削除する
+ * 
+ * @return 0なら成功. キーがなければ-ENOENT
+ */
+static long device_kv_del(const struct ioctl_kv *kv) {
+	struct device_entry *entry;
+	struct device_key key;
+	char buf[KV_KEY_MAX];
+	long ret;
+
+	ret = device_copy_key(kv, buf, &key);
+
+	if (ret) {
+		return ret;
+	}
+
+	mutex_lock(&store_lock);
+	entry = rhashtable_lookup_fast(&store, &key, store_params);
+
+	if (entry == NULL) {
+		ret = -ENOENT;
+	} else {
+		ret = rhashtable_remove_fast(&store, &entry->node, store_params);
+	}
+	mutex_unlock(&store_lock);
+
+	if (ret == 0) {
+		call_srcu(&message_srcu, &entry->rcu, device_entry_free);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief モジュールの削除時に, storeに残っているエントリを解放する
+ */
+static void device_entry_destroy(void *ptr, void *arg) {
+	kfree(ptr);
+}
+
 /**
  * @brief ioctl()が呼び出されたときの処理. 通常のread()やwrite()ではできないデバイス固有の操作を実現できる
  * 
@@ -137,30 +548,18 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
 	int i;
 	long ret = SUCCESS;
 
-	/* 排他制御: デバイスが既にオープンされていないかチェック */
-	if (atomic_cmpxchg(&already_open, CDEV_NOT_USED, CDEV_EXCLUSIVE_OPEN)) {
-		return -EBUSY;
-	}
-
+	/*
+	 * 読み込みのコマンドはSRCUの中でメッセージやエントリを参照し, 書き込みのコマンドは新しいものに
+	 * 差し替えるので, 全てのコマンドを排他制御なしで並列に実行できる
+	 */
 	/* 受け取ったioctl_numに応じて, 異なる動作を実行する */
 	switch (ioctl_num) {
 	/* メッセージを設定 */
-	case IOCTL_SET_MSG: {
-		/* ioctl_paramはユーザ空間の文字列のポインタであるのでキャストする(char __user *tmp) */
-		char __user *tmp = (char __user *)ioctl_param;
-		char ch;
-
-		/* tmpの最初の文字をカーネル空間へのコピー */
-		get_user(ch, tmp);
-		/* BUF_LENまでの文字列を取得 */
-		for (i = 0; ch && i < BUF_LEN; i++, tmp++) {
-			get_user(ch, tmp);
-		}
-
-		/* 取得したデータをmessageに格納する */
-		device_write(file, (char __user *)ioctl_param, i, NULL);
+	case IOCTL_SET_MSG:
+		/* ioctl_paramはユーザ空間の文字列のポインタであるのでキャストする. 格納した長さを返す */
+		ret = device_set_msg((const char __user *)ioctl_param);
 		break;
-	}
+
 	/* メッセージを取得 */
 	case IOCTL_GET_MSG: {
 		loff_t offset = 0;
@@ -169,22 +568,60 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
 		 * ioctl_paramは, ユーザ空間のバッファのポインタであるのでキャストする
 		 * device_read()を呼び出して, messageの内容をioctl_paramにコピー
 		 */
-		i = device_read(file, (char __user *)ioctl_param, 99, &offset);
+		i = device_read(file, (char __user *)ioctl_param, BUF_LEN, &offset);
+
+		if (i < 0) {
+			ret = i;
+			break;
+		}
 
 		/* 取得したデータの最後に'\0'を追加する */
-		put_user('\0', (char __user *)ioctl_param + i);
+		if (put_user('\0', (char __user *)ioctl_param + i)) {
+			ret = -EFAULT;
+		}
 		break;
 	}
 	/* メッセージのnバイト目を取得 */
 	case IOCTL_GET_NTH_BYTE:
 		/* ioctl_paramは, 取得したいバイト位置(n) */
 		/* message[n]の値をlong型で返す */
-		ret = (long)message[ioctl_param];
+		ret = device_get_nth_byte(ioctl_param);
+		break;
+
+	/* メッセージの一部を1回で取得 */
+	case IOCTL_GET_RANGE: {
+		struct ioctl_range range;
+
+		if (copy_from_user(&range, (void __user *)ioctl_param, sizeof(range))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = device_get_range(&range);
 		break;
 	}
 
-	/* デバイスの使用状態をCDEV_NOT_USEDに戻す */
-	atomic_set(&already_open, CDEV_NOT_USED);
+	/* キーと値を格納, 取得, 削除 */
+	case IOCTL_PUT:
+	case IOCTL_GET:
+	case IOCTL_DEL: {
+		struct ioctl_kv kv;
+
+		if (copy_from_user(&kv, (void __user *)ioctl_param, sizeof(kv))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (ioctl_num == IOCTL_PUT) {
+			ret = device_kv_put(&kv);
+		} else if (ioctl_num == IOCTL_GET) {
+			ret = device_kv_get(&kv);
+		} else {
+			ret = device_kv_del(&kv);
+		}
+		break;
+	}
+	}
 
 	return ret;
 }
@@ -205,12 +642,34 @@ static struct file_operations fops = {
  * @brief カーネルモジュール初期化関数
  */
 static int __init chardev_init(void) {
+	struct device_message *msg;
+	int ret_val;
+
+	/* 読み込み側がNULLを確かめずに済むように, 空のメッセージを用意しておく */
+	msg = device_message_alloc();
+
+	if (msg == NULL) {
+		return -ENOMEM;
+	}
+
+	RCU_INIT_POINTER(message, msg);
+
+	/* キーの数に合わせて自動で拡大, 縮小する */
+	ret_val = rhashtable_init(&store, &store_params);
+
+	if (ret_val) {
+		device_message_destroy(msg);
+		return ret_val;
+	}
+
 	/* キャラクタデバイスを登録する */
-	int ret_val = register_chrdev(MAJOR_NUM, DEVICE_FILE_NAME, &fops);
+	ret_val = register_chrdev(MAJOR_NUM, DEVICE_FILE_NAME, &fops);
 
 	if (ret_val < 0) {
 		pr_alert("%s failed with %d\n", "Sorry, registering the character device ", ret_val);
 
+		rhashtable_destroy(&store);
+		device_message_destroy(msg);
 		return ret_val;
 	}
 
@@ -241,6 +700,11 @@ static void __exit chardev_exit(void) {
 
 	/* 登録したデバイスをカーネルから削除 */
 	unregister_chrdev(MAJOR_NUM, DEVICE_FILE_NAME);
+
+	/* 差し替えられたメッセージとエントリの解放を待ってから, 残りを解放する */
+	srcu_barrier(&message_srcu);
+	rhashtable_free_and_destroy(&store, device_entry_destroy, NULL);
+	device_message_destroy(rcu_dereference_protected(message, 1));
 }
 
 module_init(chardev_init);
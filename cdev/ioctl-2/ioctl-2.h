@@ -7,12 +7,18 @@
 #define CHARDEV_H
 
 #include <linux/ioctl.h>	/* デバイスドライバとのやり取りを行うための_IO, _IOR, _IOW, _IOWRなどのマクロを提供する */
+#include <linux/types.h>	/* ユーザ空間と共有する構造体で使う__u32, __u64などの型を提供する */
 
 /**
  * @def メジャー番号
  */
 #define MAJOR_NUM 100
 
+/**
+ * @def メッセージを格納するバッファの大きさ. 終端の'\0'を含むので, メッセージは最大4095バイト
+ */
+#define MSG_BUF_LEN 4096
+
 /**
  * @def ユーザ空間からカーネルモジュールに情報を渡すためのioctlコマンド番号を作成する
  * 
@@ -21,13 +27,14 @@
  * 3番目の引数は, プロセスからカーネルに取得したい型である
  * 
  * ユーザプログラムからカーネルモジュールにメッセージ(char *)を送る
+ * 戻り値は格納したメッセージの長さ. MSG_BUF_LENに収まらないときは-E2BIGを返す
  */
 #define IOCTL_SET_MSG _IOW(MAJOR_NUM, 0, char *)
 
 /**
  * @def 出力に使用され, デバイスドライバのメッセージを取得する
  * 
- * ユーザプログラムがカーネルからメッセージを取得する
+ * ユーザプログラムがカーネルからメッセージを取得する. バッファはMSG_BUF_LENバイト用意する
  */
 #define IOCTL_GET_MSG _IOR(MAJOR_NUM, 1, char *)
 
@@ -38,6 +45,66 @@
  */
 #define IOCTL_GET_NTH_BYTE _IOWR(MAJOR_NUM, 2, int)
 
+/**
+ * @struct ioctl_range
+ * @brief IOCTL_GET_RANGEに渡す, 取得したいメッセージの範囲とコピー先
+ */
+struct ioctl_range {
+	//! 取得を始めるバイト位置
+	__u32 offset;
+	//! 取得したいバイト数
+	__u32 len;
+	//! コピー先のユーザ空間のバッファへのポインタ(lenバイト以上)
+	__u64 buf;
+};
+
+/**
+ * @def メッセージのoffsetバイト目からlenバイトを1回で取得する
+ * 
+ * メッセージの終端を越える分は取得しない. 戻り値はコピーしたバイト数で, '\0'は付けない
+ * offsetがメッセージの長さを越えているときは-EINVALを返す
+ */
+#define IOCTL_GET_RANGE _IOWR(MAJOR_NUM, 3, struct ioctl_range)
+
+/**
+ * @def キーの最大の長さ(バイト)
+ */
+#define KV_KEY_MAX 256
+
+/**
+ * @struct ioctl_kv
+ * @brief IOCTL_PUT, IOCTL_GET, IOCTL_DELに渡す, キーと値のバッファ
+ * 
+ * キーと値はバイト列として扱い, '\0'で終わる必要はない
+ */
+struct ioctl_kv {
+	//! キーへのポインタ
+	__u64 key;
+	//! キーの長さ(1からKV_KEY_MAXまで)
+	__u32 key_len;
+	//! 値の長さ. IOCTL_PUTでは格納する値の長さ(MSG_BUF_LENまで), IOCTL_GETではバッファの大きさ
+	__u32 value_len;
+	//! 値へのポインタ. IOCTL_DELでは使わない
+	__u64 value;
+};
+
+/**
+ * @def キーに値を格納する. 既にキーがあれば値を置き換える
+ */
+#define IOCTL_PUT _IOW(MAJOR_NUM, 4, struct ioctl_kv)
+
+/**
+ * @def キーの値を取得する
+ * 
+ * バッファに収まる分だけをコピーし, 値全体の長さを返す. キーがなければ-ENOENTを返す
+ */
+#define IOCTL_GET _IOW(MAJOR_NUM, 5, struct ioctl_kv)
+
+/**
+ * @def キーを削除する. キーがなければ-ENOENTを返す
+ */
+#define IOCTL_DEL _IOW(MAJOR_NUM, 6, struct ioctl_kv)
+
 /**
  * @def デバイスファイル名
  */
@@ -0,0 +1,215 @@
+/**
+ * @file ioctl_get_bench.c
+ *
+ * 1つのファイルディスクリプタを共有する多数のスレッドから, メッセージを読み込むコマンドを呼び出し,
+ * 1秒あたりの呼び出し回数と失敗した回数を計測する
+ *   get_msg:  IOCTL_GET_MSG
+ *   range:    IOCTL_GET_RANGE
+ *   nth_byte: IOCTL_GET_NTH_BYTE
+ * 書き込みスレッドの数を指定すると, 計測中にIOCTL_SET_MSGでメッセージを差し替え続ける
+ * 読み込んだメッセージが2つのメッセージのどちらとも一致しなければ, 壊れた読み込みとして数える
+ *
+ * 使用例 -- sudo ./ioctl_get_bench [秒数] [最大スレッド数] [書き込みスレッド数]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "ioctl-2.h"
+
+//! 書き込みスレッドが交互に設定する, 同じ長さの2つのメッセージ
+static const char *messages[] = {
+	"The quick brown fox jumps over the lazy dog.",
+	"THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG.",
+};
+
+#define MESSAGE_LEN 44
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+//! 全てのスレッドが共有するファイルディスクリプタ
+static int fd;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	unsigned int cmd;
+	unsigned long ops;
+	unsigned long errors;
+	unsigned long torn;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief 読み込んだ内容が, どちらかのメッセージと一致するかを返す
+ */
+static int is_valid(const char *buf) {
+	return memcmp(buf, messages[0], MESSAGE_LEN) == 0 || memcmp(buf, messages[1], MESSAGE_LEN) == 0;
+}
+
+/**
+ * @brief 指定したCPUに固定して, t->cmdのコマンドを繰り返す
+ */
+static void *bench_reader(void *arg) {
+	struct bench_thread *t = arg;
+	char buf[MSG_BUF_LEN];
+	struct ioctl_range range = { .offset = 0, .len = MESSAGE_LEN, .buf = (uintptr_t)buf };
+	unsigned long n = 0;
+	cpu_set_t set;
+	int ret;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		switch (t->cmd) {
+		case IOCTL_GET_MSG:
+			ret = ioctl(fd, IOCTL_GET_MSG, buf);
+			if (ret == 0 && !is_valid(buf)) {
+				t->torn++;
+			}
+			break;
+		case IOCTL_GET_RANGE:
+			ret = ioctl(fd, IOCTL_GET_RANGE, &range);
+			if (ret == MESSAGE_LEN && !is_valid(buf)) {
+				t->torn++;
+			}
+			break;
+		default:
+			ret = ioctl(fd, IOCTL_GET_NTH_BYTE, n++ % MESSAGE_LEN);
+			break;
+		}
+
+		if (ret < 0) {
+			t->errors++;
+		} else {
+			t->ops++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 2つのメッセージを交互に設定し続ける
+ */
+static void *bench_writer(void *arg) {
+	struct bench_thread *t = arg;
+	unsigned long n = 0;
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (ioctl(fd, IOCTL_SET_MSG, messages[n++ & 1]) < 0) {
+			t->errors++;
+		} else {
+			t->ops++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief nthreads個の読み込みスレッドとnwriters個の書き込みスレッドで計測し, 結果を表示する
+ */
+static int run(const char *label, unsigned int cmd, int nthreads, int nwriters, int seconds) {
+	struct bench_thread *threads;
+	unsigned long ops = 0, errors = 0, torn = 0, sets = 0;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * (nthreads + nwriters));
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+
+	for (i = 0; i < nthreads + nwriters; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus, .cmd = cmd };
+		pthread_create(&threads[i].tid, NULL, i < nthreads ? bench_reader : bench_writer, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads + nwriters; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (i < nthreads) {
+			ops += threads[i].ops;
+			torn += threads[i].torn;
+		} else {
+			sets += threads[i].ops;
+		}
+		errors += threads[i].errors;
+	}
+
+	printf("%-10s %8d %16.0f %16.0f %10lu %10lu\n", label, nthreads,
+		   (double)ops / seconds, (double)sets / seconds, errors, torn);
+
+	free(threads);
+	return 0;
+}
+
+/**
+ * @brief 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する
+ */
+static int run_all(const char *label, unsigned int cmd, int max_threads, int nwriters, int seconds) {
+	int n;
+
+	for (n = 1; n < max_threads; n *= 2) {
+		if (run(label, cmd, n, nwriters, seconds)) {
+			return -1;
+		}
+	}
+
+	return run(label, cmd, max_threads, nwriters, seconds);
+}
+
+int main(int argc, char *argv[]) {
+	int seconds, max_threads, nwriters, ret = 0;
+
+	seconds = argc > 1 ? atoi(argv[1]) : 2;
+	max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	nwriters = argc > 3 ? atoi(argv[3]) : 0;
+
+	if (seconds <= 0 || max_threads <= 0 || nwriters < 0) {
+		printf("Usage: %s [seconds] [max threads] [writer threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ioctl(fd, IOCTL_SET_MSG, messages[0]) < 0) {
+		perror("ioctl");
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("writers: %d\n", nwriters);
+	printf("%-10s %8s %16s %16s %10s %10s\n", "command", "threads", "gets/s", "sets/s", "errors", "torn");
+
+	ret |= run_all("get_msg", IOCTL_GET_MSG, max_threads, nwriters, seconds);
+	ret |= run_all("range", IOCTL_GET_RANGE, max_threads, nwriters, seconds);
+	ret |= run_all("nth_byte", IOCTL_GET_NTH_BYTE, max_threads, nwriters, seconds);
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file ioctl_kv_bench.c
+ *
+ * IOCTL_PUTで指定した数のキーを格納し, 多数のスレッドからIOCTL_GETでランダムなキーを検索して,
+ * 1秒あたりの検索回数を計測する. 最後にIOCTL_DELで全てのキーを削除する
+ * 格納と削除の速度も表示し, 検索で取得した値がキーに対応するものかを確かめる
+ *
+ * 使用例 -- sudo ./ioctl_kv_bench [キーの数] [秒数] [最大スレッド数]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioctl-2.h"
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+//! 全てのスレッドが共有するファイルディスクリプタ
+static int fd;
+
+//! 格納するキーの数
+static unsigned long nkeys;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	unsigned long gets;
+	unsigned long errors;
+	unsigned long mismatches;
+} __attribute__((aligned(64)));
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief i番目のキーと値を作り, それぞれの長さを返す
+ */
+static void make_kv(unsigned long i, char *key, int *key_len, char *value, int *value_len) {
+	*key_len = sprintf(key, "config/key-%08lu", i);
+	*value_len = sprintf(value, "value-%lu", i * 2654435761UL);
+}
+
+/**
+ * @brief 指定したCPUに固定して, ランダムなキーの検索を繰り返す
+ */
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = arg;
+	unsigned int seed = t->cpu * 2654435761U + 1;
+	char key[64], value[64], expected[64];
+	struct ioctl_kv kv = { .key = (uintptr_t)key, .value = (uintptr_t)value, .value_len = sizeof(value) };
+	int key_len, value_len, ret;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		/* xorshiftでスレッドごとに独立した乱数を作る */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		make_kv(seed % nkeys, key, &key_len, expected, &value_len);
+		kv.key_len = key_len;
+
+		ret = ioctl(fd, IOCTL_GET, &kv);
+		if (ret < 0) {
+			t->errors++;
+			continue;
+		}
+
+		if (ret != value_len || memcmp(value, expected, value_len) != 0) {
+			t->mismatches++;
+		}
+		t->gets++;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 全てのキーを格納または削除し, 1秒あたりの回数を表示する
+ */
+static int fill(unsigned int cmd, const char *label) {
+	char key[64], value[64];
+	struct ioctl_kv kv = { .key = (uintptr_t)key, .value = (uintptr_t)value };
+	int key_len, value_len;
+	unsigned long i;
+	double start, elapsed;
+
+	start = now();
+	for (i = 0; i < nkeys; i++) {
+		make_kv(i, key, &key_len, value, &value_len);
+		kv.key_len = key_len;
+		kv.value_len = value_len;
+
+		if (ioctl(fd, cmd, &kv) < 0) {
+			printf("%s %s: %s\n", label, key, strerror(errno));
+			return -1;
+		}
+	}
+	elapsed = now() - start;
+
+	printf("%-6s %10lu keys %16.0f ops/s\n", label, nkeys, nkeys / elapsed);
+	return 0;
+}
+
+/**
+ * @brief nthreads個のスレッドで検索を計測し, 結果を表示する
+ */
+static int run(int nthreads, int seconds) {
+	struct bench_thread *threads;
+	struct timespec start, end;
+	unsigned long gets = 0, errors = 0, mismatches = 0;
+	double elapsed;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * nthreads);
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus };
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		gets += threads[i].gets;
+		errors += threads[i].errors;
+		mismatches += threads[i].mismatches;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%-6s %10d %16.0f %16.0f %10lu %10lu\n", "get", nthreads, gets / elapsed,
+		   gets / elapsed / nthreads, errors, mismatches);
+
+	free(threads);
+	return errors || mismatches ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	char missing[] = "config/missing";
+	char value[64];
+	struct ioctl_kv kv = { .key = (uintptr_t)missing, .key_len = sizeof(missing) - 1,
+						   .value = (uintptr_t)value, .value_len = sizeof(value) };
+	int seconds, max_threads, n, ret = 0;
+
+	nkeys = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	seconds = argc > 2 ? atoi(argv[2]) : 2;
+	max_threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (nkeys == 0 || seconds <= 0 || max_threads <= 0) {
+		printf("Usage: %s [keys] [seconds] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fill(IOCTL_PUT, "put")) {
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	/* 格納していないキーは見つからない */
+	if (ioctl(fd, IOCTL_GET, &kv) != -1 || errno != ENOENT) {
+		printf("lookup of a missing key did not return ENOENT\n");
+		ret = -1;
+	}
+
+	printf("%-6s %10s %16s %16s %10s %10s\n", "op", "threads", "gets/s", "gets/s/thread", "errors", "mismatch");
+
+	/* 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する */
+	for (n = 1; n < max_threads && ret == 0; n *= 2) {
+		ret |= run(n, seconds);
+	}
+	if (ret == 0) {
+		ret |= run(max_threads, seconds);
+	}
+
+	ret |= fill(IOCTL_DEL, "del");
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file ioctl_range_bench.c
+ *
+ * デバイスのメッセージ全体を取得する速度を, 2通りの方法で比較する
+ *   nth_byte: IOCTL_GET_NTH_BYTEで1バイトずつ取得する(1バイトに1回のシステムコール)
+ *   range:    IOCTL_GET_RANGEで全体を1回で取得する
+ * 初めに, 2通りの方法で取得した内容が書き込んだメッセージと一致することを確かめる
+ *
+ * 使用例 -- sudo ./ioctl_range_bench [メッセージの長さ] [秒数]
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioctl-2.h"
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief IOCTL_GET_NTH_BYTEで1バイトずつ, lenバイトを取得する
+ */
+static int get_nth_bytes(int fd, char *buf, size_t len) {
+	size_t i;
+	int c;
+
+	for (i = 0; i < len; i++) {
+		c = ioctl(fd, IOCTL_GET_NTH_BYTE, i);
+		if (c < 0) {
+			perror("ioctl");
+			return -1;
+		}
+		buf[i] = c;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief IOCTL_GET_RANGEで, lenバイトを1回で取得する
+ */
+static int get_range(int fd, char *buf, size_t len) {
+	struct ioctl_range range = { .offset = 0, .len = len, .buf = (uintptr_t)buf };
+	int ret = ioctl(fd, IOCTL_GET_RANGE, &range);
+
+	if (ret < 0) {
+		perror("ioctl");
+		return -1;
+	}
+
+	return ret == (int)len ? 0 : -1;
+}
+
+/**
+ * @brief getでメッセージ全体の取得を繰り返し, 1秒あたりのバイト数を表示する
+ */
+static int run(const char *label, int fd, int (*get)(int, char *, size_t),
+			   char *buf, size_t len, double seconds) {
+	unsigned long reads = 0;
+	double start, elapsed;
+
+	start = now();
+	do {
+		if (get(fd, buf, len)) {
+			return -1;
+		}
+		reads++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-10s %8zu %16.0f bytes/s %16.0f reads/s\n", label, len,
+		   reads * len / elapsed, reads / elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	size_t len = argc > 1 ? strtoul(argv[1], NULL, 0) : 79;
+	double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+	char *message, *buf;
+	size_t i;
+	int fd, ret = 0;
+
+	if (len == 0 || seconds <= 0) {
+		printf("Usage: %s [message length] [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	message = malloc(len + 1);
+	buf = malloc(len);
+	if (!message || !buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < len; i++) {
+		message[i] = 'a' + i % 26;
+	}
+	message[len] = '\0';
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ioctl(fd, IOCTL_SET_MSG, message) < 0) {
+		perror("ioctl");
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	/* デバイスに入りきらなかった分は計測しない */
+	len = ioctl(fd, IOCTL_GET_RANGE, &(struct ioctl_range){ .len = len, .buf = (uintptr_t)buf });
+	if ((ssize_t)len <= 0) {
+		printf("message is empty\n");
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(buf, 0, len);
+	if (get_nth_bytes(fd, buf, len) || memcmp(buf, message, len) != 0) {
+		printf("nth_byte does not match the message\n");
+		ret = -1;
+	}
+
+	memset(buf, 0, len);
+	if (get_range(fd, buf, len) || memcmp(buf, message, len) != 0) {
+		printf("range does not match the message\n");
+		ret = -1;
+	}
+
+	if (ret == 0) {
+		ret |= run("nth_byte", fd, get_nth_bytes, buf, len, seconds);
+		ret |= run("range", fd, get_range, buf, len, seconds);
+	}
+
+	close(fd);
+	free(message);
+	free(buf);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file ioctl_set_bench.c
+ *
+ * IOCTL_SET_MSGで設定するメッセージの長さを16バイトからMSG_BUF_LEN - 1バイトまで変え,
+ * 1秒あたりに設定できるメッセージ数とバイト数を計測する
+ * 初めに, 設定したメッセージの長さが返ること, 収まらないメッセージが-E2BIGになることを確かめる
+ *
+ * 使用例 -- sudo ./ioctl_set_bench [秒数]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ioctl-2.h"
+
+static const size_t lengths[] = { 16, 80, 256, 1024, MSG_BUF_LEN - 1 };
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 長さlenのメッセージを作る
+ */
+static void fill(char *buf, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = 'a' + i % 26;
+	}
+	buf[len] = '\0';
+}
+
+/**
+ * @brief 戻り値と, 取得したメッセージが設定したものと一致するかを確かめる
+ */
+static int check(int fd, char *buf) {
+	char *got;
+	int ret;
+
+	got = malloc(MSG_BUF_LEN);
+	if (!got) {
+		perror("malloc");
+		return -1;
+	}
+
+	fill(buf, MSG_BUF_LEN - 1);
+	ret = ioctl(fd, IOCTL_SET_MSG, buf);
+	if (ret != MSG_BUF_LEN - 1) {
+		printf("IOCTL_SET_MSG returned %d, expected %d\n", ret, MSG_BUF_LEN - 1);
+		free(got);
+		return -1;
+	}
+
+	if (ioctl(fd, IOCTL_GET_MSG, got) < 0 || strcmp(got, buf) != 0) {
+		printf("IOCTL_GET_MSG does not match the message\n");
+		free(got);
+		return -1;
+	}
+
+	/* 終端を含めてMSG_BUF_LENバイトを越えるメッセージは格納できない */
+	fill(buf, MSG_BUF_LEN);
+	ret = ioctl(fd, IOCTL_SET_MSG, buf);
+	if (ret != -1 || errno != E2BIG) {
+		printf("too long message: returned %d (%s), expected E2BIG\n", ret, strerror(errno));
+		free(got);
+		return -1;
+	}
+
+	free(got);
+	return 0;
+}
+
+/**
+ * @brief 長さlenのメッセージの設定を繰り返し, 結果を表示する
+ */
+static int run(int fd, char *buf, size_t len, double seconds) {
+	unsigned long sets = 0;
+	double start, elapsed;
+
+	fill(buf, len);
+
+	start = now();
+	do {
+		if (ioctl(fd, IOCTL_SET_MSG, buf) != (int)len) {
+			perror("ioctl");
+			return -1;
+		}
+		sets++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%8zu %16.0f sets/s %16.0f bytes/s\n", len, sets / elapsed, sets * len / elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+	char *buf;
+	unsigned int i;
+	int fd, ret = 0;
+
+	if (seconds <= 0) {
+		printf("Usage: %s [seconds]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	buf = malloc(MSG_BUF_LEN + 1);
+	if (!buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	if (check(fd, buf)) {
+		close(fd);
+		free(buf);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%8s\n", "length");
+
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		ret |= run(fd, buf, lengths[i], seconds);
+	}
+
+	close(fd);
+	free(buf);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -7,9 +7,11 @@
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <string.h>
 
 /**
  * @brief メッセージをデバイスに送る
@@ -17,14 +19,17 @@
 int ioctl_set_msg(int file_desc, char *message) {
 	int ret_val;
 
-	/* IOCTL_SET_MSGを呼び出し, デバイスにメッセージを送る */
+	/* IOCTL_SET_MSGを呼び出し, デバイスにメッセージを送る. 格納された長さが返る */
 	ret_val = ioctl(file_desc, IOCTL_SET_MSG, message);
 
 	if (ret_val < 0) {
 		printf("ioctl_set_msg failed:%d\n", ret_val);
+		return ret_val;
 	}
 
-	return ret_val;
+	printf("set_msg length:%d\n", ret_val);
+
+	return 0;
 }
 
 /**
@@ -32,7 +37,7 @@ int ioctl_set_msg(int file_desc, char *message) {
  */
 int ioctl_get_msg(int file_desc) {
 	int ret_val;
-	char message[100] = {0};
+	char message[MSG_BUF_LEN] = {0};
 
 	/* IOCTL_GET_MSGを呼び出し, デバイスからメッセージを取得 */
 	ret_val = ioctl(file_desc, IOCTL_GET_MSG, message);
@@ -47,26 +52,27 @@ int ioctl_get_msg(int file_desc) {
 }
 
 /**
- * @brief メッセージをiバイトずつ取得
+ * @brief メッセージのoffsetバイト目から最大lenバイトを1回のioctlで取得
  */
-int ioctl_get_nth_byte(int file_desc) {
-	int i, c;
-
-	printf("get_nth_byte message:");
+int ioctl_get_range(int file_desc, unsigned int offset, unsigned int len) {
+	int ret_val;
+	char message[100] = {0};
+	struct ioctl_range range = {
+		.offset = offset,
+		.len = len < sizeof(message) - 1 ? len : sizeof(message) - 1,
+		.buf = (uintptr_t)message,
+	};
 
-	i = 0;
-	/* 1バイトずつデバイスから取得する */
-	do {
-		c = ioctl(file_desc, IOCTL_GET_NTH_BYTE, i++);
+	/* IOCTL_GET_RANGEを呼び出し, 指定した範囲をまとめて取得する */
+	ret_val = ioctl(file_desc, IOCTL_GET_RANGE, &range);
 
-		if (c < 0) {
-			printf("\nioctl_get_nth_byte failed at the %d'th byte\n", i);
-			return c;
-		}
+	if (ret_val < 0) {
+		printf("ioctl_get_range failed:%d\n", ret_val);
+		return ret_val;
+	}
 
-		/* 取得したバイトを表示 */
-		putchar(c);
-	} while (c != 0);
+	/* 戻り値は取得したバイト数. '\0'は付かないが, バッファは0で初期化してある */
+	printf("get_range message(%u, %d bytes):%s", offset, ret_val, message);
 
 	return 0;
 }
@@ -93,8 +99,8 @@ int main(void) {
 		goto error;
 	}
 
-	/* 1バイトずつ取得する */
-	ret_val = ioctl_get_nth_byte(file_desc);
+	/* 先頭からメッセージの長さだけを1回で取得する */
+	ret_val = ioctl_get_range(file_desc, 0, strlen(msg));
 	if (ret_val) {
 		goto error;
 	}
@@ -2,34 +2,86 @@
  * @file reverse.c
  * 
  * 書き込まれた文字列を逆順にして返すキャラクタデバイス
- * 書き込み例 -- sudo bash -c 'echo "hello" > /dev/reverse'
- * 読み込み例 -- sudo cat /dev/reverse
+ * オープンごとに独立したセッションを持つので, 書き込みと読み込みは同じファイルディスクリプタで行う
+ * 使用例 -- sudo bash -c 'exec 3<>/dev/reverse; echo "hello" >&3; cat <&3'
  */
 #include "reverse.h"
 
+#include <linux/version.h>
+
 #include <linux/atomic.h>
 #include <linux/cdev.h>
+#include <linux/completion.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+#include <linux/crc32.h>
+#else
+#include <linux/crc32c.h>
+#endif
 #include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/pipe_fs_i.h>
 #include <linux/printk.h>
+#include <linux/slab.h>
+#include <linux/splice.h>
 #include <linux/uaccess.h>
-#include <linux/version.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
 
 #include <asm/errno.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
+#ifdef CONFIG_X86_64
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
 
 //! デバイスドライバに割り当てるメジャー番号
 int major;
 
-//! デバイスへの複数アクセスを防ぐための状態を持つ
-atomic_t already_open = ATOMIC_INIT(CDEV_NOT_USED);
+//! オープンごとのセッションを確保するためのスラブキャッシュ
+struct kmem_cache *session_cache;
+
+//! 保持できるメッセージの最大サイズ(バイト)
+static unsigned long max_size = DEFAULT_MAX_SIZE;
+module_param(max_size, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(max_size, "Maximum number of bytes held by the device");
+
+//! SIMD命令による反転を使うかどうか. 0にすると常にスカラ実装を使う
+static bool use_simd = true;
+module_param(use_simd, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(use_simd, "Use the SIMD byte reversal when the CPU supports it");
+
+//! ロード時にCPUの機能から選んだSIMD実装. 使えなければNULL
+static void (*reverse_swap_simd)(u8 *, u8 *, size_t) __read_mostly;
+
+//! 選んだ実装の名前
+static const char *reverse_impl = "scalar";
+
+//! このバイト数以上の反転は複数のCPUで並列に行う. 0ならロード時に計測した値を使う
+static unsigned long parallel_threshold = 0;
+module_param(parallel_threshold, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(parallel_threshold, "Reverse buffers of at least this many bytes in parallel (0: auto-tuned)");
 
-//! デバイスが受け取るメッセージ
-char msg[BUF_LEN + 1];
+//! 並列に反転させるときの最大の分割数(呼び出し元を含む). 0ならオンラインのCPU数, 1なら並列化しない
+static unsigned int max_workers = 0;
+module_param(max_workers, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(max_workers, "Maximum number of CPUs used for one reversal (0: all online CPUs)");
 
-//! デバイスが反転させるメッセージ
-char rev_msg[BUF_LEN + 1];
+//! ロード時の計測で決めたparallel_thresholdの値
+static unsigned long auto_threshold = REVERSE_PARALLEL_MAX;
+
+//! 並列に反転させる区間を処理するworkqueue
+static struct workqueue_struct *reverse_wq;
 
 //! device_create()に使用するクラス構造体
 struct class *cls;
@@ -42,17 +94,41 @@ struct file_operations cdev_fops = {
 	.open = device_open,
 	.release = device_release,
 	.read = device_read,
-	.write = device_write,
+	.write_iter = device_write_iter,
+	.splice_read = device_splice_read,
+	.splice_write = iter_file_splice_write,
+	.unlocked_ioctl = device_ioctl,
+	.mmap = device_mmap,
 };
 
 /**
  * @brief カーネルモジュールの起動処理. キャラクタデバイスの作成を行う
  */
 static int __init chardev_init(void) {
+	reverse_select_impl();
+
+	/* 区間はどのCPUで処理してもよいので, CPUに縛られないworkqueueを使う */
+	reverse_wq = alloc_workqueue("reverse", WQ_UNBOUND, 0);
+	if (!reverse_wq) {
+		return -ENOMEM;
+	}
+
+	reverse_calibrate_parallel();
+
+	/* 短時間のオープンとクローズを繰り返しても安く済むように, 専用のキャッシュから確保する */
+	session_cache = kmem_cache_create("reverse_session", sizeof(struct reverse_session),
+									  0, SLAB_HWCACHE_ALIGN, reverse_session_ctor);
+	if (!session_cache) {
+		destroy_workqueue(reverse_wq);
+		return -ENOMEM;
+	}
+
 	major = register_chrdev(0, DEVICE_NAME, &cdev_fops);
 
 	if (major < 0) {
 		pr_alert("Registering char device failed with %d\n", major);
+		kmem_cache_destroy(session_cache);
+		destroy_workqueue(reverse_wq);
 		return major;
 	}
 
@@ -65,7 +141,7 @@ static int __init chardev_init(void) {
 #endif
 	device_create(cls, NULL, MKDEV(major, 0), NULL, DEVICE_NAME);
 
-	pr_info("Device created on /dev/%s\n", DEVICE_NAME);
+	pr_info("Device created on /dev/%s (%s reversal)\n", DEVICE_NAME, reverse_impl);
 
 	return SUCCESS;
 }
@@ -78,16 +154,40 @@ static void __exit chardev_exit(void) {
 	class_destroy(cls);
 
 	unregister_chrdev(major, DEVICE_NAME);
+
+	kmem_cache_destroy(session_cache);
+	destroy_workqueue(reverse_wq);
+}
+
+/**
+ * @brief スラブキャッシュのコンストラクタ. オブジェクトが最初に作られたときだけ呼ばれる
+ * 
+ * セッションは空のバッファと未ロックのmutexの状態でキャッシュに返すので, オープン時の初期化は不要になる
+ */
+static void reverse_session_ctor(void *obj) {
+	struct reverse_session *session = obj;
+
+	memset(&session->buf, 0, sizeof(session->buf));
+	mutex_init(&session->lock);
+	mutex_init(&session->io_lock);
+	session->mode = REVERSE_MODE_WHOLE;
+	reverse_chain_reset(session);
 }
 
 /**
  * @brief プロセスがデバイスファイルを開くときの処理
+ * 
+ * オープンごとにセッションを確保するので, 複数のクライアントが並列に反転できる
  */
 static int device_open(struct inode *inode, struct file *file) {
-	if (atomic_cmpxchg(&already_open, CDEV_NOT_USED, CDEV_EXCLUSIVE_OPEN)) {
-		return -EBUSY;
+	struct reverse_session *session;
+
+	session = kmem_cache_alloc(session_cache, GFP_KERNEL);
+	if (!session) {
+		return -ENOMEM;
 	}
 
+	file->private_data = session;
 	try_module_get(THIS_MODULE);
 
 	return SUCCESS;
@@ -97,62 +197,1219 @@ static int device_open(struct inode *inode, struct file *file) {
  * @brief プロセスがデバイスファイルを閉じるときの処理
  */
 static int device_release(struct inode *inode, struct file *file) {
-	atomic_set(&already_open, CDEV_NOT_USED);
+	struct reverse_session *session = file->private_data;
+
+	/* コンストラクタ直後と同じ空の状態に戻してからキャッシュに返す */
+	reverse_buffer_reset(&session->buf);
+	session->mode = REVERSE_MODE_WHOLE;
+	reverse_chain_reset(session);
+	kmem_cache_free(session_cache, session);
 
 	module_put(THIS_MODULE);
 
 	return SUCCESS;
 }
 
+/**
+ * @brief 変換の連鎖を反転だけの初期状態に戻す
+ */
+static void reverse_chain_reset(struct reverse_session *session) {
+	session->reverse = true;
+	session->use_map = false;
+	session->use_crc32c = false;
+	session->crc32c = 0;
+}
+
+/**
+ * @brief 1バイトにop(REVERSE_OP_LOWER, REVERSE_OP_UPPER, REVERSE_OP_ROT13)を適用する
+ */
+static u8 reverse_op_apply(u32 op, u8 c) {
+	switch (op) {
+	case REVERSE_OP_LOWER:
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	case REVERSE_OP_UPPER:
+		return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+	case REVERSE_OP_ROT13:
+		if (c >= 'a' && c <= 'z') {
+			return 'a' + (c - 'a' + 13) % 26;
+		}
+		if (c >= 'A' && c <= 'Z') {
+			return 'A' + (c - 'A' + 13) % 26;
+		}
+		return c;
+	default:
+		return c;
+	}
+}
+
+/**
+ * @brief 変換の連鎖を設定する. session->lockを取得して呼び出す
+ * 
+ * バイトごとの変換は位置によらないので反転と順序を入れ替えてもよく,
+ * 全てを1つの256要素の表に合成して反転の入れ替えと同時に適用する
+ * どの変換もASCIIの英字しか書き換えないので, UTF-8の複数バイトの文字を壊すことはない
+ */
+static long reverse_chain_set(struct reverse_session *session, const struct reverse_chain *chain) {
+	bool reverse = false, use_map = false, use_crc32c = false;
+	u8 map[256];
+	unsigned int i, c;
+
+	if (chain->nr_ops > REVERSE_CHAIN_MAX) {
+		return -EINVAL;
+	}
+
+	if (chain->nr_ops == 0) {
+		reverse_chain_reset(session);
+		return 0;
+	}
+
+	for (c = 0; c < 256; c++) {
+		map[c] = c;
+	}
+
+	for (i = 0; i < chain->nr_ops; i++) {
+		switch (chain->ops[i]) {
+		case REVERSE_OP_REVERSE:
+			/* 2回反転させると元の順序に戻るので, 現れるたびに切り替える */
+			reverse = !reverse;
+			break;
+		case REVERSE_OP_LOWER:
+		case REVERSE_OP_UPPER:
+		case REVERSE_OP_ROT13:
+			for (c = 0; c < 256; c++) {
+				map[c] = reverse_op_apply(chain->ops[i], map[c]);
+			}
+			use_map = true;
+			break;
+		case REVERSE_OP_CRC32C:
+			/* CRC32Cは変換後のデータ全体にかかるので, 最後にしか置けない */
+			if (i != chain->nr_ops - 1) {
+				return -EINVAL;
+			}
+			use_crc32c = true;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	session->reverse = reverse;
+	session->use_map = use_map;
+	session->use_crc32c = use_crc32c;
+	memcpy(session->map, map, sizeof(map));
+
+	return 0;
+}
+
+/**
+ * @brief バッファの全てのページを手放し, 空の状態に戻す
+ */
+static void reverse_buffer_reset(struct reverse_buffer *buf) {
+	unsigned int i;
+
+	for (i = 0; i < buf->nr_pages; i++) {
+		put_page(buf->pages[i]);
+	}
+	kvfree(buf->pages);
+
+	buf->pages = NULL;
+	buf->nr_pages = 0;
+	buf->max_pages = 0;
+	buf->len = 0;
+	buf->reversed = false;
+	buf->mapped = false;
+	buf->spliced = false;
+}
+
+/**
+ * @brief パイプと共有しているページを複製に置き換える. 内容はそのまま残る
+ * 
+ * mmap()の前に呼び出し, パイプに渡したデータがユーザ空間からの書き込みで変わらないようにする
+ */
+static int reverse_buffer_unshare(struct reverse_buffer *buf) {
+	struct page *page;
+	unsigned int i;
+
+	if (!buf->spliced) {
+		return 0;
+	}
+
+	for (i = 0; i < buf->nr_pages; i++) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			return -ENOMEM;
+		}
+
+		copy_page(page_address(page), page_address(buf->pages[i]));
+		put_page(buf->pages[i]);
+		buf->pages[i] = page;
+	}
+
+	buf->spliced = false;
+
+	return 0;
+}
+
+/**
+ * @brief バッファの末尾にページを1つ追加する. ページ配列が足りなければ倍に広げる
+ */
+static int reverse_buffer_grow(struct reverse_buffer *buf) {
+	struct page *page;
+
+	if (buf->nr_pages == buf->max_pages) {
+		unsigned int max_pages = max(buf->max_pages * 2, 16U);
+		struct page **pages = kvmalloc_array(max_pages, sizeof(*pages), GFP_KERNEL);
+
+		if (!pages) {
+			return -ENOMEM;
+		}
+
+		if (buf->nr_pages) {
+			memcpy(pages, buf->pages, buf->nr_pages * sizeof(*pages));
+		}
+		kvfree(buf->pages);
+
+		buf->pages = pages;
+		buf->max_pages = max_pages;
+	}
+
+	/* mmap()でページ全体がユーザ空間に見えるので, 古いカーネルのデータが残らないようにゼロで埋める */
+	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!page) {
+		return -ENOMEM;
+	}
+
+	buf->pages[buf->nr_pages++] = page;
+
+	return 0;
+}
+
+/**
+ * @brief バッファ内の位置posに対応するカーネル仮想アドレスを返す
+ */
+static inline u8 *reverse_buffer_ptr(struct reverse_buffer *buf, size_t pos) {
+	return (u8 *)page_address(buf->pages[pos >> PAGE_SHIFT]) + offset_in_page(pos);
+}
+
+/**
+ * @brief front[i]とback[n - 1 - i]を1バイトずつ入れ替える. frontとbackは重ならない
+ */
+static void reverse_swap_scalar(u8 *front, u8 *back, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		u8 tmp = front[i];
+
+		front[i] = back[n - 1 - i];
+		back[n - 1 - i] = tmp;
+	}
+}
+
+/**
+ * @brief front[i]とback[n - 1 - i]を入れ替えながら, 両方にmapを適用する
+ * 
+ * 256要素の任意の表引きはpshufbでは表せないので, スカラ実装だけを持つ
+ */
+static void reverse_swap_map(u8 *front, u8 *back, size_t n, const u8 *map) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		u8 tmp = front[i];
+
+		front[i] = map[back[n - 1 - i]];
+		back[n - 1 - i] = map[tmp];
+	}
+}
+
+#ifdef CONFIG_X86_64
+/**
+ * @brief pshufbで16バイトを逆順に並べ替えるためのマスク. AVX2では128ビットのレーンごとに使う
+ */
+static const u8 reverse_shuffle_mask[32] __aligned(32) = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+};
+
+/**
+ * @brief SSSE3のpshufbで16バイトずつ入れ替える
+ */
+static void reverse_swap_ssse3(u8 *front, u8 *back, size_t n) {
+	size_t i;
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqa %0, %%xmm2" : : "m" (reverse_shuffle_mask[0]));
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		/* 先頭側のfront[i, i + 16)と末尾側のback[n - i - 16, n - i)をそれぞれ反転させて入れ替える */
+		asm volatile("movdqu (%0), %%xmm0\n\t"
+					 "movdqu (%1), %%xmm1\n\t"
+					 "pshufb %%xmm2, %%xmm0\n\t"
+					 "pshufb %%xmm2, %%xmm1\n\t"
+					 "movdqu %%xmm0, (%1)\n\t"
+					 "movdqu %%xmm1, (%0)\n\t"
+					 : : "r" (front + i), "r" (back + n - i - 16) : "memory");
+	}
+
+	kernel_fpu_end();
+
+	/* 16バイトに満たない残りはスカラで入れ替える */
+	reverse_swap_scalar(front + i, back, n - i);
+}
+
+/**
+ * @brief AVX2で32バイトずつ入れ替える
+ * 
+ * vpshufbは128ビットのレーンの中でしか並べ替えられないので, vpermqで上下のレーンも入れ替える
+ */
+static void reverse_swap_avx2(u8 *front, u8 *back, size_t n) {
+	size_t i;
+
+	kernel_fpu_begin();
+
+	asm volatile("vmovdqa %0, %%ymm2" : : "m" (reverse_shuffle_mask[0]));
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		asm volatile("vmovdqu (%0), %%ymm0\n\t"
+					 "vmovdqu (%1), %%ymm1\n\t"
+					 "vpshufb %%ymm2, %%ymm0, %%ymm0\n\t"
+					 "vpshufb %%ymm2, %%ymm1, %%ymm1\n\t"
+					 "vpermq $0x4e, %%ymm0, %%ymm0\n\t"
+					 "vpermq $0x4e, %%ymm1, %%ymm1\n\t"
+					 "vmovdqu %%ymm0, (%1)\n\t"
+					 "vmovdqu %%ymm1, (%0)\n\t"
+					 : : "r" (front + i), "r" (back + n - i - 32) : "memory");
+	}
+
+	asm volatile("vzeroupper");
+
+	kernel_fpu_end();
+
+	reverse_swap_scalar(front + i, back, n - i);
+}
+#endif /* CONFIG_X86_64 */
+
+/**
+ * @brief CPUの機能を調べ, 使えるSIMD実装を選ぶ. モジュールのロード時に1度だけ呼び出す
+ */
+static void __init reverse_select_impl(void) {
+#ifdef CONFIG_X86_64
+	if (boot_cpu_has(X86_FEATURE_AVX2) && boot_cpu_has(X86_FEATURE_OSXSAVE) &&
+		cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL)) {
+		reverse_swap_simd = reverse_swap_avx2;
+		reverse_impl = "avx2";
+	} else if (boot_cpu_has(X86_FEATURE_SSSE3)) {
+		reverse_swap_simd = reverse_swap_ssse3;
+		reverse_impl = "ssse3";
+	}
+#endif
+}
+
+/**
+ * @brief front[i]とback[n - 1 - i]を入れ替える. frontとbackは重ならない
+ * 
+ * FPUレジスタの退避にかかる時間の方が大きくなる短い範囲は, スカラ実装で入れ替える
+ * mapがNULLでなければ, 入れ替えと同じ走査で各バイトを変換する
+ */
+static void reverse_swap(u8 *front, u8 *back, size_t n, const u8 *map) {
+	if (map) {
+		reverse_swap_map(front, back, n, map);
+	} else if (n >= REVERSE_SIMD_MIN && reverse_swap_simd && READ_ONCE(use_simd)) {
+		reverse_swap_simd(front, back, n);
+	} else {
+		reverse_swap_scalar(front, back, n);
+	}
+}
+
+/**
+ * @brief 先頭側のheadから前向きに, 末尾側のtailから後ろ向きにnバイトずつ入れ替える
+ * 
+ * どちらのページ境界もまたがない範囲ずつ入れ替えていく
+ */
+static void reverse_buffer_swap(struct reverse_buffer *buf, size_t head, size_t tail, size_t n,
+								const u8 *map) {
+	while (n) {
+		size_t chunk = min_t(size_t, n,
+							 min_t(size_t, PAGE_SIZE - offset_in_page(head),
+								   offset_in_page(tail - 1) + 1));
+
+		reverse_swap(reverse_buffer_ptr(buf, head), reverse_buffer_ptr(buf, tail - chunk), chunk, map);
+		head += chunk;
+		tail -= chunk;
+		n -= chunk;
+	}
+}
+
+/**
+ * @brief workqueueから呼び出され, 割り当てられた区間の組を入れ替える
+ */
+static void reverse_work_handler(struct work_struct *work) {
+	struct reverse_work *rw = container_of(work, struct reverse_work, work);
+
+	reverse_buffer_swap(rw->buf, rw->head, rw->tail, rw->n, rw->map);
+
+	/* 最後に終わった区間が呼び出し元を起こす */
+	if (atomic_dec_and_test(rw->pending)) {
+		complete(rw->done);
+	}
+}
+
+/**
+ * @brief [start, start + len)を対称な区間の組に分け, 複数のCPUで並列に入れ替える
+ * 
+ * k番目の組は先頭からk番目の区間と末尾からk番目の区間で, 組どうしは重ならない
+ * 呼び出し元も最初の組を担当し, 残りの組が終わるのをcompletionで待つ
+ * 
+ * @return 並列に反転させたらtrue. 分割するほど大きくない, またはメモリが足りなければfalse
+ */
+static bool reverse_buffer_reverse_parallel(struct reverse_buffer *buf, size_t start, size_t len,
+											const u8 *map) {
+	DECLARE_COMPLETION_ONSTACK(done);
+	size_t half = len / 2;
+	unsigned int nr = READ_ONCE(max_workers);
+	struct reverse_work *works;
+	atomic_t pending;
+	size_t chunk, offset;
+	unsigned int i;
+
+	if (nr == 0) {
+		nr = num_online_cpus();
+	}
+
+	/* 区間はページ単位に揃え, 小さくなりすぎないようにする */
+	nr = min_t(size_t, nr, DIV_ROUND_UP(half, REVERSE_PARALLEL_CHUNK_MIN));
+	if (nr < 2) {
+		return false;
+	}
+
+	chunk = round_up(DIV_ROUND_UP(half, nr), PAGE_SIZE);
+	nr = DIV_ROUND_UP(half, chunk);
+	if (nr < 2) {
+		return false;
+	}
+
+	works = kmalloc_array(nr - 1, sizeof(*works), GFP_KERNEL);
+	if (!works) {
+		return false;
+	}
+
+	atomic_set(&pending, nr - 1);
+
+	for (i = 1; i < nr; i++) {
+		struct reverse_work *rw = &works[i - 1];
+
+		offset = i * chunk;
+		rw->buf = buf;
+		rw->map = map;
+		rw->head = start + offset;
+		rw->tail = start + len - offset;
+		rw->n = min(chunk, half - offset);
+		rw->pending = &pending;
+		rw->done = &done;
+
+		INIT_WORK(&rw->work, reverse_work_handler);
+		queue_work(reverse_wq, &rw->work);
+	}
+
+	reverse_buffer_swap(buf, start, start + len, chunk, map);
+
+	wait_for_completion(&done);
+	kfree(works);
+
+	return true;
+}
+
+/**
+ * @brief バッファの[start, start + len)をその場で逆順にする
+ * 
+ * parallel_threshold以上の大きさなら複数のCPUで並列に入れ替える
+ * mapがNULLでなければ, 範囲内の全てのバイトに同時に適用する
+ */
+static void reverse_buffer_reverse(struct reverse_buffer *buf, size_t start, size_t len,
+								   const u8 *map) {
+	size_t threshold = READ_ONCE(parallel_threshold);
+
+	if (threshold == 0) {
+		threshold = auto_threshold;
+	}
+
+	if (!(len >= threshold && reverse_buffer_reverse_parallel(buf, start, len, map))) {
+		reverse_buffer_swap(buf, start, start + len, len / 2, map);
+	}
+
+	/* 長さが奇数なら, 入れ替えの対象にならない中央の1バイトにも適用する */
+	if (map && (len & 1)) {
+		u8 *mid = reverse_buffer_ptr(buf, start + len / 2);
+
+		*mid = map[*mid];
+	}
+}
+
+/**
+ * @brief 反転させずに, バッファの[start, start + len)の各バイトにmapを適用する
+ */
+static void reverse_buffer_map(struct reverse_buffer *buf, size_t start, size_t len, const u8 *map) {
+	while (len) {
+		size_t chunk = min_t(size_t, len, PAGE_SIZE - offset_in_page(start));
+		u8 *p = reverse_buffer_ptr(buf, start);
+		size_t i;
+
+		for (i = 0; i < chunk; i++) {
+			p[i] = map[p[i]];
+		}
+		start += chunk;
+		len -= chunk;
+	}
+}
+
+/**
+ * @brief バッファの[start, start + len)に変換の連鎖を1回の走査で適用する
+ */
+static void reverse_session_apply(struct reverse_session *session, size_t start, size_t len) {
+	const u8 *map = session->use_map ? session->map : NULL;
+
+	if (session->reverse) {
+		reverse_buffer_reverse(&session->buf, start, len, map);
+	} else if (map) {
+		reverse_buffer_map(&session->buf, start, len, map);
+	}
+}
+
+/**
+ * @brief 並列化の閾値を決める. モジュールのロード時に1度だけ呼び出す
+ * 
+ * 1つのCPUでの反転速度と, workqueueに処理を渡して完了を待つまでの時間を計測し,
+ * 1つのCPUでの反転時間が受け渡しの時間のREVERSE_PARALLEL_FACTOR倍になる大きさを閾値とする
+ */
+static void __init reverse_calibrate_parallel(void) {
+	struct reverse_buffer buf = {};
+	struct reverse_work rw;
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t pending;
+	u64 start, serial_ns, dispatch_ns;
+	unsigned int i;
+
+	for (i = 0; i < REVERSE_CALIBRATE_PAGES; i++) {
+		if (reverse_buffer_grow(&buf)) {
+			goto out;
+		}
+	}
+	buf.len = (size_t)REVERSE_CALIBRATE_PAGES << PAGE_SHIFT;
+
+	/* 1つのCPUで全体を反転させる時間 */
+	start = ktime_get_ns();
+	reverse_buffer_swap(&buf, 0, buf.len, buf.len / 2, NULL);
+	serial_ns = ktime_get_ns() - start;
+
+	/* 何もしない区間をworkqueueに渡し, 完了を待つまでの時間 */
+	start = ktime_get_ns();
+	for (i = 0; i < REVERSE_CALIBRATE_ROUNDS; i++) {
+		reinit_completion(&done);
+		atomic_set(&pending, 1);
+		rw = (struct reverse_work){
+			.buf = &buf, .head = 0, .tail = buf.len, .n = 0,
+			.pending = &pending, .done = &done,
+		};
+		INIT_WORK_ONSTACK(&rw.work, reverse_work_handler);
+		queue_work(reverse_wq, &rw.work);
+		wait_for_completion(&done);
+		destroy_work_on_stack(&rw.work);
+	}
+	dispatch_ns = (ktime_get_ns() - start) / REVERSE_CALIBRATE_ROUNDS;
+
+	auto_threshold = clamp_t(u64,
+							 div64_u64((u64)buf.len * dispatch_ns * REVERSE_PARALLEL_FACTOR,
+									   max_t(u64, serial_ns, 1)),
+							 REVERSE_PARALLEL_MIN, REVERSE_PARALLEL_MAX);
+
+	pr_info("%llu ns for %zu bytes, %llu ns per dispatch, parallel threshold %lu bytes\n",
+			serial_ns, buf.len, dispatch_ns, auto_threshold);
+out:
+	reverse_buffer_reset(&buf);
+}
+
+/**
+ * @brief バッファの[pos, pos + n)をdstにコピーする. ページ境界をまたいでもよい
+ */
+static void reverse_buffer_read(struct reverse_buffer *buf, size_t pos, void *dst, size_t n) {
+	while (n) {
+		size_t chunk = min_t(size_t, n, PAGE_SIZE - offset_in_page(pos));
+
+		memcpy(dst, reverse_buffer_ptr(buf, pos), chunk);
+		dst += chunk;
+		pos += chunk;
+		n -= chunk;
+	}
+}
+
+/**
+ * @brief 改行で区切られたレコードを, それぞれ独立に反転させる
+ */
+static void reverse_records_newline(struct reverse_session *session) {
+	struct reverse_buffer *buf = &session->buf;
+	size_t start = 0;
+	size_t pos = 0;
+
+	while (pos < buf->len) {
+		size_t chunk = min_t(size_t, buf->len - pos, PAGE_SIZE - offset_in_page(pos));
+		u8 *p = reverse_buffer_ptr(buf, pos);
+		u8 *nl = memchr(p, '\n', chunk);
+
+		if (!nl) {
+			pos += chunk;
+			continue;
+		}
+
+		/* 改行の手前までを反転させ, 次のレコードは改行の直後から始まる */
+		pos += nl - p;
+		reverse_session_apply(session, start, pos - start);
+		start = ++pos;
+	}
+
+	/* 改行で終わっていない最後のレコード */
+	reverse_session_apply(session, start, buf->len - start);
+}
+
+/**
+ * @brief 4バイトの長さが先頭に付いたレコードを, それぞれ独立に反転させる
+ * 
+ * 長さが残りのデータを超えるレコードは, 残りのデータだけを反転させる
+ */
+static void reverse_records_length(struct reverse_session *session) {
+	struct reverse_buffer *buf = &session->buf;
+	size_t pos = 0;
+	u32 record_len;
+
+	while (buf->len - pos >= sizeof(record_len)) {
+		reverse_buffer_read(buf, pos, &record_len, sizeof(record_len));
+		pos += sizeof(record_len);
+
+		record_len = min_t(size_t, record_len, buf->len - pos);
+		reverse_session_apply(session, pos, record_len);
+		pos += record_len;
+	}
+}
+
+/**
+ * @brief UTF-8として正しいかを検証する(RFC 3629)
+ * 
+ * 日本語のテキストでも改行や空白などのASCIIの並びは多いので, 8バイトずつまとめて最上位ビットを調べ,
+ * ASCIIだけが続く部分を読み飛ばす. 複数バイトの文字はページ境界をまたいでもよい
+ */
+static bool reverse_utf8_validate(struct reverse_buffer *buf) {
+	unsigned int need = 0;	// 残りの継続バイト数
+	u8 lo = 0x80, hi = 0xBF;	// 次の継続バイトとして許される範囲
+	size_t pos = 0;
+
+	while (pos < buf->len) {
+		size_t chunk = min_t(size_t, buf->len - pos, PAGE_SIZE - offset_in_page(pos));
+		const u8 *p = reverse_buffer_ptr(buf, pos);
+		size_t i = 0;
+
+		while (i < chunk) {
+			u8 c;
+
+			if (need == 0) {
+				while (i + 8 <= chunk && !(get_unaligned((const u64 *)(p + i)) & REVERSE_HIGH_BITS)) {
+					i += 8;
+				}
+				if (i == chunk) {
+					break;
+				}
+
+				c = p[i++];
+				if (c < 0x80) {
+					continue;
+				} else if (c >= 0xC2 && c <= 0xDF) {
+					need = 1;
+				} else if (c >= 0xE0 && c <= 0xEF) {
+					need = 2;
+					/* 3バイトより短く表せる文字とサロゲートを除く */
+					if (c == 0xE0) {
+						lo = 0xA0;
+					} else if (c == 0xED) {
+						hi = 0x9F;
+					}
+				} else if (c >= 0xF0 && c <= 0xF4) {
+					need = 3;
+					/* 4バイトより短く表せる文字とU+10FFFFを超える文字を除く */
+					if (c == 0xF0) {
+						lo = 0x90;
+					} else if (c == 0xF4) {
+						hi = 0x8F;
+					}
+				} else {
+					return false;
+				}
+			} else {
+				c = p[i++];
+				if (c < lo || c > hi) {
+					return false;
+				}
+				lo = 0x80;
+				hi = 0xBF;
+				need--;
+			}
+		}
+
+		pos += chunk;
+	}
+
+	/* 文字の途中で終わっていないこと */
+	return need == 0;
+}
+
+/**
+ * @brief バイト単位で反転させたUTF-8の各文字を, 元のバイト順に戻す
+ * 
+ * 反転後は1文字が「継続バイトの並び + 先頭バイト」の順になるので, その範囲をもう一度反転させる
+ */
+static void reverse_utf8_fixup(struct reverse_buffer *buf) {
+	size_t start = 0;
+	bool in_char = false;
+	size_t pos = 0;
+
+	while (pos < buf->len) {
+		size_t chunk = min_t(size_t, buf->len - pos, PAGE_SIZE - offset_in_page(pos));
+		const u8 *p = reverse_buffer_ptr(buf, pos);
+		size_t i = 0;
+
+		while (i < chunk) {
+			u8 c;
+
+			if (!in_char) {
+				while (i + 8 <= chunk && !(get_unaligned((const u64 *)(p + i)) & REVERSE_HIGH_BITS)) {
+					i += 8;
+				}
+				if (i == chunk) {
+					break;
+				}
+			}
+
+			c = p[i];
+			if ((c & 0xC0) == 0x80) {
+				/* 継続バイト. 文字の始まりを覚えておく */
+				if (!in_char) {
+					start = pos + i;
+					in_char = true;
+				}
+			} else if (c >= 0xC0) {
+				/* 先頭バイト. 覚えておいた位置からここまでを反転させる */
+				reverse_buffer_reverse(buf, start, pos + i - start + 1, NULL);
+				in_char = false;
+			}
+			i++;
+		}
+
+		pos += chunk;
+	}
+}
+
+/**
+ * @brief 変換後のメッセージ全体のCRC32Cをページごとに計算する
+ * 
+ * crc32c()はCPUのcrc32命令を使う実装が選ばれる
+ */
+static u32 reverse_buffer_crc32c(struct reverse_buffer *buf) {
+	u32 crc = ~0U;
+	size_t pos = 0;
+
+	while (pos < buf->len) {
+		size_t chunk = min_t(size_t, buf->len - pos, PAGE_SIZE - offset_in_page(pos));
+
+		crc = crc32c(crc, reverse_buffer_ptr(buf, pos), chunk);
+		pos += chunk;
+	}
+
+	return ~crc;
+}
+
+/**
+ * @brief 書き込み後の最初の読み込みで一度だけメッセージを変換する. session->lockを取得して呼び出す
+ * 
+ * 変換の連鎖のうち, 反転とバイトごとの変換は1回の走査で行い, CRC32Cはその後に計算する
+ * 
+ * @return 成功したら0. UTF-8のモードで正しくないデータが書き込まれていたら-EILSEQ
+ */
+static int reverse_session_prepare(struct reverse_session *session) {
+	struct reverse_buffer *buf = &session->buf;
+
+	if (buf->reversed) {
+		return 0;
+	}
+
+	switch (session->mode) {
+	case REVERSE_MODE_NEWLINE:
+		reverse_records_newline(session);
+		break;
+	case REVERSE_MODE_LENGTH:
+		reverse_records_length(session);
+		break;
+	case REVERSE_MODE_UTF8:
+		/* 正しくないデータは破棄し, 次の書き込みから新しいメッセージとして受け付ける */
+		if (!reverse_utf8_validate(buf)) {
+			buf->len = 0;
+			buf->reversed = true;
+			return -EILSEQ;
+		}
+		reverse_session_apply(session, 0, buf->len);
+		if (session->reverse) {
+			reverse_utf8_fixup(buf);
+		}
+		break;
+	default:
+		reverse_session_apply(session, 0, buf->len);
+		break;
+	}
+
+	if (session->use_crc32c) {
+		session->crc32c = reverse_buffer_crc32c(buf);
+	}
+
+	buf->reversed = true;
+
+	return 0;
+}
+
 /**
  * @brief プロセスがデバイスファイルから読み込もうとしたときの処理
+ * 
+ * copy_to_user()のページフォルトはmmap_lockを取得するので, ページの参照を持ってからlockを手放してコピーする
  */
 static ssize_t device_read(struct file *filp, char __user *buffer,
 					       size_t length, loff_t *offset) {
-	size_t msg_len = strlen(rev_msg);  // 逆順メッセージの長さ
+	struct reverse_session *session = filp->private_data;
+	struct reverse_buffer *buf = &session->buf;
+	size_t bytes_read = 0;
+	ssize_t ret = 0;
+
+	mutex_lock(&session->io_lock);
+	mutex_lock(&session->lock);
+
+	ret = reverse_session_prepare(session);
+	if (ret) {
+		mutex_unlock(&session->lock);
+		mutex_unlock(&session->io_lock);
+		return ret;
+	}
 
 	// オフセットがメッセージの長さ以上なら、読み取るデータはない
-	if (*offset >= msg_len) {
+	if (*offset >= buf->len) {
+		mutex_unlock(&session->lock);
+		mutex_unlock(&session->io_lock);
 		return 0;  // EOF（End of File）
 	}
 
-	size_t bytes_read = msg_len - *offset;  // 読み取るデータの残りの長さ
-	if (length < bytes_read) {
-		bytes_read = length;  // ユーザーが要求した長さに合わせる
-	}
+	length = min_t(size_t, length, buf->len - *offset);  // ユーザーが要求した長さに合わせる
 
-	// ユーザ空間にデータをコピー
-	if (copy_to_user(buffer, rev_msg + *offset, bytes_read) != 0) {
-		return -EFAULT;  // copy_to_user() 失敗時にエラー返す
+	// ページごとにユーザ空間にデータをコピー
+	while (bytes_read < length) {
+		size_t pos = *offset + bytes_read;
+		size_t n = min_t(size_t, length - bytes_read, PAGE_SIZE - offset_in_page(pos));
+		struct page *page = buf->pages[pos >> PAGE_SHIFT];
+		unsigned long left;
+
+		/* コピー中にmmap()がページを複製に置き換えても, 参照を持っているので解放されない */
+		get_page(page);
+		mutex_unlock(&session->lock);
+		left = copy_to_user(buffer + bytes_read, (u8 *)page_address(page) + offset_in_page(pos), n);
+		put_page(page);
+		mutex_lock(&session->lock);
+
+		if (left != 0) {
+			ret = -EFAULT;  // copy_to_user() 失敗時にエラー返す
+			break;
+		}
+		bytes_read += n;
 	}
 
+	mutex_unlock(&session->lock);
+	mutex_unlock(&session->io_lock);
+
 	*offset += bytes_read;  // オフセットを更新して次回読み込み位置を設定
 
-	return bytes_read;  // 実際に読み込んだバイト数を返す
+	return bytes_read ? bytes_read : ret;  // 実際に読み込んだバイト数を返す
 }
 
+/**
+ * @brief splice()やsendfile()でデバイスからパイプへ読み込むときの処理
+ * 
+ * 反転済みのページの参照カウントを増やしてパイプに渡すので, データのコピーは発生しない
+ * 次の書き込みでは新しいページを確保し, 後からmmap()するときはreverse_buffer_unshare()で
+ * 複製に置き換えるため, パイプに渡したページが後から書き換わることはない
+ * mmap()されたセッションはページを使い続け, ユーザ空間やREVERSE_IOC_RANGEが書き換えるので,
+ * パイプにはページの複製を渡す
+ */
+static ssize_t device_splice_read(struct file *filp, loff_t *ppos,
+								  struct pipe_inode_info *pipe, size_t len,
+								  unsigned int flags) {
+	struct reverse_session *session = filp->private_data;
+	struct reverse_buffer *buf = &session->buf;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &nosteal_pipe_buf_ops,
+		.spd_release = device_spd_release,
+	};
+	size_t pos = *ppos;
+	ssize_t ret;
+
+	mutex_lock(&session->io_lock);
+	mutex_lock(&session->lock);
+
+	ret = reverse_session_prepare(session);
+	if (ret) {
+		mutex_unlock(&session->lock);
+		mutex_unlock(&session->io_lock);
+		return ret;
+	}
+
+	if (pos >= buf->len) {
+		mutex_unlock(&session->lock);
+		mutex_unlock(&session->io_lock);
+		return 0;
+	}
+
+	len = min_t(size_t, len, buf->len - pos);
+
+	while (len && spd.nr_pages < PIPE_DEF_BUFFERS) {
+		size_t n = min_t(size_t, len, PAGE_SIZE - offset_in_page(pos));
+		struct page *page = buf->pages[pos >> PAGE_SHIFT];
+
+		if (buf->mapped) {
+			page = alloc_page(GFP_KERNEL);
+			if (!page) {
+				break;
+			}
+			memcpy((u8 *)page_address(page) + offset_in_page(pos), reverse_buffer_ptr(buf, pos), n);
+		} else {
+			get_page(page);
+			buf->spliced = true;
+		}
+
+		pages[spd.nr_pages] = page;
+		partial[spd.nr_pages].offset = offset_in_page(pos);
+		partial[spd.nr_pages].len = n;
+		spd.nr_pages++;
+		pos += n;
+		len -= n;
+	}
+
+	mutex_unlock(&session->lock);
+	mutex_unlock(&session->io_lock);
+
+	if (spd.nr_pages == 0) {
+		return -ENOMEM;
+	}
+
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret > 0) {
+		*ppos += ret;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief splice_to_pipe()がパイプに渡せなかったページの参照を解放する
+ */
+static void device_spd_release(struct splice_pipe_desc *spd, unsigned int i) {
+	put_page(spd->pages[i]);
+}
+
+/**
+ * @brief 読み込まれた後の最初の書き込みで, 前のメッセージを新しいメッセージの先頭で置き換える
+ * 
+ * 先頭のページを新しいバッファに受け取ってから前のメッセージを破棄するので,
+ * 1バイトも受け取れなかった書き込みでは前のメッセージがそのまま残る
+ * session->io_lockとsession->lockを取得して呼び出す. コピーの間はlockを手放す
+ * 
+ * @return 受け取ったバイト数. 1バイトも受け取れなければ負のエラー番号
+ */
+static ssize_t reverse_session_restart(struct reverse_session *session, struct iov_iter *from, size_t limit) {
+	struct reverse_buffer *buf = &session->buf;
+	struct reverse_buffer fresh = { 0 };
+	size_t n = min_t(size_t, iov_iter_count(from), min_t(size_t, PAGE_SIZE, limit));
+	size_t copied;
+	int ret;
+
+	if (n == 0) {
+		return -ENOSPC;
+	}
+
+	/* freshはこの関数の中でしか見えないので, lockを手放してから確保, コピーする */
+	mutex_unlock(&session->lock);
+
+	ret = reverse_buffer_grow(&fresh);
+	copied = ret ? 0 : copy_from_iter(page_address(fresh.pages[0]), n, from);
+
+	mutex_lock(&session->lock);
+
+	if (copied == 0) {
+		reverse_buffer_reset(&fresh);
+		return ret ? ret : -EFAULT;
+	}
+
+	/**
+	 * mmap()されたページはユーザ空間と共有しているので, 手放さずに先頭ページへ書き写す
+	 * コピーの間にmmap()されることもあるので, lockを取り直してから確かめる
+	 */
+	if (buf->mapped) {
+		memcpy(page_address(buf->pages[0]), page_address(fresh.pages[0]), copied);
+		reverse_buffer_reset(&fresh);
+		buf->len = copied;
+		buf->reversed = false;
+	} else {
+		reverse_buffer_reset(buf);
+		*buf = fresh;
+		buf->len = copied;
+	}
+
+	return copied;
+}
 
 /**
  * @brief プロセスがデバイスファイルに書き込むときの処理
+ * 
+ * 書き込まれたデータはページを継ぎ足しながら末尾に追加し, max_sizeまで保持する
+ * 読み込まれた後の書き込みは, 新しいメッセージとして最初から書き始め, ファイル位置も先頭に戻す
+ * ただし前のメッセージを破棄してファイル位置を戻すのは, 1バイト以上受け取れたときだけにする
+ * VFSは書き込みが失敗するとki_posをファイル位置に書き戻さないので, 両方をそろえておく
+ * 書き込みはファイル位置を進めないので, 同じファイルディスクリプタで書き込みと読み込みを繰り返せる
+ * write_iterで実装しているので, splice()でパイプから書き込むこともできる
+ * copy_from_iter()のページフォルトはmmap_lockを取得するので, ページの参照を持ってからlockを手放してコピーする
  */
-static ssize_t device_write(struct file *filp, const char __user *buffer,
-							size_t length, loff_t *offset) {
-	size_t bytes_write = (length < BUF_LEN) ? length : BUF_LEN;  // 書き込むデータの長さを制限
+static ssize_t device_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+	struct reverse_session *session = iocb->ki_filp->private_data;
+	struct reverse_buffer *buf = &session->buf;
+	size_t limit = READ_ONCE(max_size);
+	size_t bytes_write = 0;
+	ssize_t ret = 0;
+
+	mutex_lock(&session->io_lock);
+	mutex_lock(&session->lock);
+
+	/* 反転済みなら読み込まれた後なので, 新しいメッセージとして書き始める */
+	if (buf->reversed && iov_iter_count(from)) {
+		ret = reverse_session_restart(session, from, limit);
+		if (ret < 0) {
+			mutex_unlock(&session->lock);
+			mutex_unlock(&session->io_lock);
+			return ret;
+		}
 
-	/* ユーザ空間からメッセージをコピーする */
-	if (copy_from_user(msg, buffer, bytes_write) != 0) {
-		return -EFAULT;  // copy_from_user() 失敗時にエラー返す
+		bytes_write = ret;
+		ret = 0;
+
+		/* 前のメッセージを読んだ位置のままだと, 新しいメッセージがEOFに見えてしまう */
+		iocb->ki_pos = 0;
 	}
 
-	msg[bytes_write] = '\0';  // 文字列の終端を追加
+	while (iov_iter_count(from)) {
+		struct page *page;
+		size_t n, copied;
+
+		if (buf->len >= limit) {
+			ret = -ENOSPC;  // 上限に達したら書き込めない
+			break;
+		}
+
+		/* 最後のページが埋まっていればページを追加する */
+		if (buf->len == (size_t)buf->nr_pages << PAGE_SHIFT) {
+			ret = reverse_buffer_grow(buf);
+			if (ret) {
+				break;
+			}
+		}
+
+		n = min_t(size_t, iov_iter_count(from),
+				  min_t(size_t, PAGE_SIZE - offset_in_page(buf->len), limit - buf->len));
+
+		/**
+		 * ユーザ空間からメッセージをコピーする
+		 * io_lockを持っているので, lockを手放している間にbuf->lenを変えるのはこの書き込みだけ
+		 */
+		page = buf->pages[buf->len >> PAGE_SHIFT];
+		get_page(page);
+		mutex_unlock(&session->lock);
+		copied = copy_from_iter((u8 *)page_address(page) + offset_in_page(buf->len), n, from);
+		put_page(page);
+		mutex_lock(&session->lock);
+
+		buf->len += copied;
+		bytes_write += copied;
 
-	/* 逆順に格納 */
-	for (size_t i = 0; i < bytes_write; i++) {
-		rev_msg[i] = msg[bytes_write - i - 1];
+		if (copied != n) {
+			ret = -EFAULT;  // コピー失敗時にエラー返す
+			break;
+		}
 	}
-	rev_msg[bytes_write] = '\0';  // 逆順データにも終端を追加
 
-	return bytes_write;  // 実際に書き込んだバイト数を返す
+	mutex_unlock(&session->lock);
+	mutex_unlock(&session->io_lock);
+
+	return bytes_write ? bytes_write : ret;  // 実際に書き込んだバイト数を返す
+}
+
+
+/**
+ * @brief mmap()したバッファの[offset, offset + len)をその場で反転させる. session->lockを取得して呼び出す
+ */
+static long reverse_session_range(struct reverse_session *session, const struct reverse_range *range) {
+	struct reverse_buffer *buf = &session->buf;
+	size_t capacity = (size_t)buf->nr_pages << PAGE_SHIFT;
+
+	/* mmap()していないページはパイプに渡している可能性があるので, その場では書き換えない */
+	if (!buf->mapped) {
+		return -EINVAL;
+	}
+
+	if (range->offset > capacity || range->len > capacity - range->offset) {
+		return -EINVAL;
+	}
+
+	reverse_buffer_reverse(buf, range->offset, range->len, NULL);
+
+	return 0;
+}
+
+/**
+ * @brief mmap()が呼び出されたときの処理. セッションのバッファをユーザ空間にマッピングする
+ * 
+ * 要求された大きさまでバッファのページを増やし, 1ページずつvm_insert_page()で挿入する
+ * remap_pfn_range()と違ってマッピングがページの参照を持つので,
+ * セッションが先に解放されてもユーザ空間から解放済みのページが見えることはない
+ * MAP_PRIVATEでは書き込みがコピーオンライトで別のページに行き, バッファに届かないので受け付けない
+ * mmap_lockを持って呼び出されるので, ユーザ空間とのコピーの間も保持されるio_lockは取得しない
+ */
+static int device_mmap(struct file *file, struct vm_area_struct *vma) {
+	struct reverse_session *session = file->private_data;
+	struct reverse_buffer *buf = &session->buf;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long nr_pages = vma->vm_pgoff + (size >> PAGE_SHIFT);
+	unsigned long i;
+	int ret = 0;
+
+	if (!(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	}
+
+	/* マッピングできるのはmax_sizeまで */
+	if (nr_pages > DIV_ROUND_UP(READ_ONCE(max_size), PAGE_SIZE)) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&session->lock);
+
+	/* パイプに渡したページをユーザ空間から書き換えられないように, 複製に置き換える */
+	ret = reverse_buffer_unshare(buf);
+	if (ret) {
+		goto out;
+	}
+
+	while (buf->nr_pages < nr_pages) {
+		ret = reverse_buffer_grow(buf);
+		if (ret) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < (size >> PAGE_SHIFT); i++) {
+		ret = vm_insert_page(vma, vma->vm_start + (i << PAGE_SHIFT),
+							 buf->pages[vma->vm_pgoff + i]);
+		if (ret) {
+			goto out;
+		}
+	}
+
+	/* 以降の書き込みでもページを入れ替えないようにする */
+	buf->mapped = true;
+out:
+	mutex_unlock(&session->lock);
+	return ret;
+}
+
+/**
+ * @brief ioctl()が呼び出されたときの処理. 反転のモードを設定, 取得する
+ * 
+ * レコードのモードでは, 1回のwrite()やwritev()で書き込んだ多数のレコードを
+ * それぞれ独立に反転させ, 1回のread()でまとめて返す
+ * REVERSE_IOC_RANGEはmmap()したバッファの一部をその場で反転させる
+ * REVERSE_IOC_SET_CHAINは反転と一緒に適用する変換の連鎖を設定する
+ */
+static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct reverse_session *session = file->private_data;
+	struct reverse_range range;
+	struct reverse_chain chain;
+	long ret;
+	u32 crc;
+	int mode;
+
+	switch (cmd) {
+	case REVERSE_IOC_SET_MODE:
+		if (arg >= REVERSE_MODE_MAX) {
+			return -EINVAL;
+		}
+
+		mutex_lock(&session->lock);
+		session->mode = arg;
+		mutex_unlock(&session->lock);
+		return 0;
+
+	case REVERSE_IOC_GET_MODE:
+		mutex_lock(&session->lock);
+		mode = session->mode;
+		mutex_unlock(&session->lock);
+
+		return put_user(mode, (int __user *)arg);
+
+	case REVERSE_IOC_RANGE:
+		if (copy_from_user(&range, (void __user *)arg, sizeof(range))) {
+			return -EFAULT;
+		}
+
+		mutex_lock(&session->lock);
+		ret = reverse_session_range(session, &range);
+		mutex_unlock(&session->lock);
+		return ret;
+
+	case REVERSE_IOC_SET_CHAIN:
+		if (copy_from_user(&chain, (void __user *)arg, sizeof(chain))) {
+			return -EFAULT;
+		}
+
+		mutex_lock(&session->lock);
+		ret = reverse_chain_set(session, &chain);
+		mutex_unlock(&session->lock);
+		return ret;
+
+	case REVERSE_IOC_GET_CRC32C:
+		mutex_lock(&session->io_lock);
+		mutex_lock(&session->lock);
+		if (!session->use_crc32c) {
+			mutex_unlock(&session->lock);
+			mutex_unlock(&session->io_lock);
+			return -EINVAL;
+		}
+
+		/* まだ読み込まれていなければ, ここで変換してCRC32Cを求める. 書き込みの途中では変換しない */
+		ret = reverse_session_prepare(session);
+		crc = session->crc32c;
+		mutex_unlock(&session->lock);
+		mutex_unlock(&session->io_lock);
+
+		if (ret) {
+			return ret;
+		}
+
+		return put_user(crc, (u32 __user *)arg);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
 
@@ -6,9 +6,16 @@
 #ifndef REVERSE_H
 #define REVERSE_H
 
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/splice.h>
 #include <linux/types.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+
+#include "reverse_ioctl.h"
 
 /**
  * @def デバイスの名前
@@ -16,15 +23,149 @@
 #define DEVICE_NAME "reverse"
 
 /**
- * @def 書き込まれた内容を保持しておくためのバッファの最大サイズ
+ * @def 書き込まれた内容を保持しておくためのバッファの最大サイズの初期値(64MiB)
+ * モジュールパラメータmax_sizeで変更できる
+ */
+#define DEFAULT_MAX_SIZE (64UL << 20)
+
+/**
+ * @def SIMD命令で入れ替える最小のバイト数. これより短い範囲はスカラ実装で入れ替える
+ */
+#define REVERSE_SIMD_MIN 64
+
+/**
+ * @def 8バイトの各バイトの最上位ビット. 0ならば8バイト全てがASCII
+ */
+#define REVERSE_HIGH_BITS 0x8080808080808080ULL
+
+/**
+ * @def 並列化の閾値の下限と上限. ロード時の計測値をこの範囲に収める
+ */
+#define REVERSE_PARALLEL_MIN (64UL << 10)
+#define REVERSE_PARALLEL_MAX (64UL << 20)
+
+/**
+ * @def 並列に入れ替えるときの1区間の最小バイト数
+ */
+#define REVERSE_PARALLEL_CHUNK_MIN (32UL << 10)
+
+/**
+ * @def 1つのCPUでの反転時間がworkqueueへの受け渡しの時間の何倍になれば並列化するか
  */
-#define BUF_LEN 80
+#define REVERSE_PARALLEL_FACTOR 4
+
+/**
+ * @def 並列化の閾値を計測するときに反転させるページ数と, 受け渡しの時間を計測する回数
+ */
+#define REVERSE_CALIBRATE_PAGES 64
+#define REVERSE_CALIBRATE_ROUNDS 16
 
 /**
  * @def 成功フラグ. 関数が成功したときに返す
  */
 #define SUCCESS 0
 
+/**
+ * @struct reverse_buffer
+ * @brief 書き込まれたメッセージをページ単位で保持するバッファ
+ */
+struct reverse_buffer {
+	//! メッセージを保持するページの配列
+	struct page **pages;
+	//! 確保したページ数
+	unsigned int nr_pages;
+	//! pagesの要素数
+	unsigned int max_pages;
+	//! メッセージの長さ
+	size_t len;
+	//! 反転済みかどうか. 書き込み後の最初の読み込みでtrueになる
+	bool reversed;
+	//! mmap()されたかどうか. trueならページをユーザ空間と共有している
+	bool mapped;
+	//! splice()でページをそのままパイプに渡したかどうか. trueならページをパイプと共有している
+	bool spliced;
+};
+
+/**
+ * @struct reverse_work
+ * @brief 並列に反転させるときに, 1つのworkが担当する区間の組
+ */
+struct reverse_work {
+	struct work_struct work;
+	//! 反転させるバッファ
+	struct reverse_buffer *buf;
+	//! 入れ替えと同時に各バイトに適用する変換表. NULLなら変換しない
+	const u8 *map;
+	//! 先頭側の区間の始まり
+	size_t head;
+	//! 末尾側の区間の終わり
+	size_t tail;
+	//! 入れ替えるバイト数
+	size_t n;
+	//! まだ終わっていないworkの数
+	atomic_t *pending;
+	//! 全てのworkが終わったときに完了させる
+	struct completion *done;
+};
+
+/**
+ * @struct reverse_session
+ * @brief オープンごとのセッション. file->private_dataに保持する
+ */
+struct reverse_session {
+	//! 書き込まれたメッセージ
+	struct reverse_buffer buf;
+	/**
+	 * bufを保護する. mmap_lockを取得したmmap()からも取得するので,
+	 * ページフォルトが起きうるユーザ空間とのコピーの間は手放す
+	 */
+	struct mutex lock;
+	//! 読み込み, 書き込み, 変換を直列にする. mmap()では取得しないので, ユーザ空間とのコピーの間も保持できる
+	struct mutex io_lock;
+	//! 反転のモード(REVERSE_MODE_*)
+	int mode;
+	//! 変換の連鎖にREVERSE_OP_REVERSEが含まれるか
+	bool reverse;
+	//! mapを適用するか. falseなら各バイトは恒等変換
+	bool use_map;
+	//! 変換後にCRC32Cを計算するか
+	bool use_crc32c;
+	//! 変換後のメッセージのCRC32C
+	u32 crc32c;
+	//! 連鎖の中のバイトごとの変換を1つに合成した表
+	u8 map[256];
+};
+
+/**
+ * @brief スラブキャッシュのコンストラクタ
+ */
+static void reverse_session_ctor(void *);
+
+/**
+ * @brief 変換の連鎖を反転だけの初期状態に戻す
+ */
+static void reverse_chain_reset(struct reverse_session *);
+
+/**
+ * @brief バッファの全てのページを手放し, 空の状態に戻す
+ */
+static void reverse_buffer_reset(struct reverse_buffer *);
+
+/**
+ * @brief パイプと共有しているページを複製に置き換える
+ */
+static int reverse_buffer_unshare(struct reverse_buffer *);
+
+/**
+ * @brief CPUの機能を調べ, 使えるSIMD実装を選ぶ
+ */
+static void reverse_select_impl(void);
+
+/**
+ * @brief 並列化の閾値を決める
+ */
+static void reverse_calibrate_parallel(void);
+
 /**
  * @brief プロセスがデバイスファイルを開くときの処理
  */
@@ -40,30 +181,42 @@ static int device_release(struct inode *, struct file *);
  */
 static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
 
+/**
+ * @brief splice()やsendfile()でデバイスからパイプへ読み込むときの処理
+ */
+static ssize_t device_splice_read(struct file *, loff_t *, struct pipe_inode_info *,
+								  size_t, unsigned int);
+
+/**
+ * @brief splice_to_pipe()がパイプに渡せなかったページの参照を解放する
+ */
+static void device_spd_release(struct splice_pipe_desc *, unsigned int);
+
+/**
+ * @brief 読み込まれた後の最初の書き込みで, 前のメッセージを新しいメッセージの先頭で置き換える
+ */
+static ssize_t reverse_session_restart(struct reverse_session *, struct iov_iter *, size_t);
+
 /**
  * @brief プロセスがデバイスファイルに書き込むときの処理
  */
-static ssize_t device_write(struct file *, const char __user *, size_t, loff_t *);
+static ssize_t device_write_iter(struct kiocb *, struct iov_iter *);
 
 /**
- * @enum デバイスへの複数アクセスを防ぐための列挙体
+ * @brief ioctl()が呼び出されたときの処理. 反転のモードを設定, 取得する
  */
-enum {
-	CDEV_NOT_USED,
-	CDEV_EXCLUSIVE_OPEN,
-};
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+
+/**
+ * @brief mmap()が呼び出されたときの処理. セッションのバッファをユーザ空間にマッピングする
+ */
+static int device_mmap(struct file *, struct vm_area_struct *);
 
 //! デバイスドライバに割り当てられるメジャー番号
 extern int major;
 
-//! デバイスへの複数アクセスを防ぐための状態を持つ
-extern atomic_t already_open;
-
-//! デバイスが受け取るメッセージ
-extern char msg[BUF_LEN + 1];
-
-//! デバイスが反転させるメッセージ
-extern char rev_msg[BUF_LEN + 1];
+//! オープンごとのセッションを確保するためのスラブキャッシュ
+extern struct kmem_cache *session_cache;
 
 //! device_create()に使用するクラス構造体
 extern struct class *cls;
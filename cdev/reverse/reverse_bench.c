@@ -0,0 +1,145 @@
+/**
+ * @file reverse_bench.c
+ *
+ * /dev/reverseの反転処理の速度を, 16Bから64MBまでのサイズで計測する
+ * デバイスは書き込み後の最初の読み込みで一度だけ反転させるので,
+ * 書き込んだ直後に1バイトだけ読み込む時間を反転にかかった時間とみなす
+ *
+ * スカラ実装(use_simd=0)とSIMD実装(use_simd=1)を切り替えてGB/sを表示する
+ * 例 -- sudo ./reverse_bench
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/reverse"
+#define USE_SIMD_PARAM "/sys/module/reverse/parameters/use_simd"
+
+#define MIN_SIZE 16UL
+#define MAX_SIZE (64UL << 20)
+
+//! 1つのサイズあたりに反転させる最低限の合計バイト数
+#define MIN_TOTAL_BYTES (256UL << 20)
+
+//! 1つのサイズあたりの最低限の繰り返し回数
+#define MIN_ITERATIONS 16
+
+/**
+ * @brief use_simdパラメータを書き換える
+ */
+static int set_use_simd(int enable) {
+	FILE *fp = fopen(USE_SIMD_PARAM, "w");
+
+	if (!fp) {
+		perror(USE_SIMD_PARAM);
+		return -1;
+	}
+
+	fprintf(fp, "%d\n", enable);
+	fclose(fp);
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief sizeバイトを書き込み, 最初の1バイトの読み込みにかかった時間を返す
+ */
+static double reverse_once(const char *data, size_t size) {
+	double start, elapsed;
+	size_t done = 0;
+	ssize_t n;
+	char c;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	while (done < size) {
+		n = write(fd, data + done, size - done);
+		if (n <= 0) {
+			perror("write");
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	start = now();
+	n = read(fd, &c, 1);
+	elapsed = now() - start;
+
+	close(fd);
+
+	if (n != 1) {
+		perror("read");
+		return -1;
+	}
+
+	return elapsed;
+}
+
+/**
+ * @brief 全てのサイズについて計測し, GB/sを表示する
+ */
+static int run(const char *label, const char *data) {
+	size_t size;
+
+	printf("[%s]\n", label);
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+		double total = 0, t;
+		unsigned long iterations = 0;
+
+		while (iterations < MIN_ITERATIONS || size * iterations < MIN_TOTAL_BYTES) {
+			t = reverse_once(data, size);
+			if (t < 0) {
+				return -1;
+			}
+			total += t;
+			iterations++;
+		}
+
+		printf("%12zu B %10.3f GB/s %12.0f ns/op\n", size,
+			   size * iterations / total / 1e9, total / iterations * 1e9);
+	}
+
+	return 0;
+}
+
+int main(void) {
+	char *data;
+	size_t i;
+	int ret = 0;
+
+	data = malloc(MAX_SIZE);
+	if (!data) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < MAX_SIZE; i++) {
+		data[i] = 'a' + i % 26;
+	}
+
+	if (set_use_simd(0) == 0) {
+		ret |= run("scalar", data);
+	}
+
+	if (set_use_simd(1) == 0) {
+		ret |= run("simd", data);
+	}
+
+	free(data);
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file reverse_chain_bench.c
+ *
+ * 反転 -> 小文字化 -> ROT13 -> CRC32Cという前処理を, 2通りの方法で行う時間を比較する
+ *   separate: /dev/reverseで反転だけを行い, 残りをユーザ空間でそれぞれ1回ずつ走査して行う
+ *   fused:    REVERSE_IOC_SET_CHAINで連鎖を設定し, デバイスの1回の走査で行う
+ * 両方の結果のCRC32Cが一致することも確かめる
+ *
+ * 使用例 -- sudo ./reverse_chain_bench
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reverse_ioctl.h"
+
+#define DEVICE_PATH "/dev/reverse"
+
+//! 1つの条件あたりの繰り返し回数
+#define ITERATIONS 16
+
+static const size_t sizes[] = { 64UL << 10, 1UL << 20, 16UL << 20 };
+
+//! CRC32C(Castagnoli)の多項式(ビット反転表現)
+#define CRC32C_POLY 0x82F63B78U
+
+static uint32_t crc32c_table[256];
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void crc32c_init(void) {
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		}
+		crc32c_table[i] = crc;
+	}
+}
+
+/**
+ * @brief ユーザ空間でのCRC32C. 使えればCPUのcrc32命令を使う
+ */
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(const unsigned char *p, size_t n) {
+	uint64_t crc = ~0U;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t v;
+
+		memcpy(&v, p + i, sizeof(v));
+		crc = __builtin_ia32_crc32di(crc, v);
+	}
+	for (; i < n; i++) {
+		crc = __builtin_ia32_crc32qi(crc, p[i]);
+	}
+
+	return ~(uint32_t)crc;
+}
+#endif
+
+static uint32_t crc32c(const unsigned char *p, size_t n) {
+	uint32_t crc = ~0U;
+	size_t i;
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		return crc32c_hw(p, n);
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ p[i]) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		n = write(fd, data + done, size - done);
+		if (n <= 0) {
+			perror("write");
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, char *data, size_t size) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		n = read(fd, data + done, size - done);
+		if (n <= 0) {
+			perror("read");
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief デバイスで反転させ, 小文字化, ROT13, CRC32Cをユーザ空間で1段ずつ行う
+ */
+static int run_separate(const char *in, char *out, size_t size, uint32_t *crc) {
+	size_t i;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (write_all(fd, in, size) || read_all(fd, out, size)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	for (i = 0; i < size; i++) {
+		if (out[i] >= 'A' && out[i] <= 'Z') {
+			out[i] += 'a' - 'A';
+		}
+	}
+
+	for (i = 0; i < size; i++) {
+		if (out[i] >= 'a' && out[i] <= 'z') {
+			out[i] = 'a' + (out[i] - 'a' + 13) % 26;
+		}
+	}
+
+	*crc = crc32c((const unsigned char *)out, size);
+	return 0;
+}
+
+/**
+ * @brief 連鎖を設定したデバイスで全ての段を1回の走査で行い, 結果とCRC32Cを受け取る
+ */
+static int run_fused(const char *in, char *out, size_t size, uint32_t *crc) {
+	struct reverse_chain chain = {
+		.nr_ops = 4,
+		.ops = { REVERSE_OP_REVERSE, REVERSE_OP_LOWER, REVERSE_OP_ROT13, REVERSE_OP_CRC32C },
+	};
+	__u32 value;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (ioctl(fd, REVERSE_IOC_SET_CHAIN, &chain) < 0) {
+		perror("ioctl");
+		close(fd);
+		return -1;
+	}
+
+	if (write_all(fd, in, size) || read_all(fd, out, size)) {
+		close(fd);
+		return -1;
+	}
+
+	if (ioctl(fd, REVERSE_IOC_GET_CRC32C, &value) < 0) {
+		perror("ioctl");
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	*crc = value;
+	return 0;
+}
+
+int main(void) {
+	size_t max = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+	char *in, *out;
+	unsigned int s;
+	size_t i;
+	int it, ret = 0;
+
+	in = malloc(max);
+	out = malloc(max);
+	if (!in || !out) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	crc32c_init();
+
+	for (i = 0; i < max; i++) {
+		in[i] = "The Quick Brown Fox Jumps Over The Lazy Dog.\n"[i % 45];
+	}
+
+	printf("%10s %14s %14s %10s %10s\n", "size", "separate MB/s", "fused MB/s", "speedup", "crc32c");
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		double start, separate, fused;
+		uint32_t crc_separate = 0, crc_fused = 0;
+
+		start = now();
+		for (it = 0; it < ITERATIONS; it++) {
+			if (run_separate(in, out, sizes[s], &crc_separate)) {
+				ret = EXIT_FAILURE;
+				goto out;
+			}
+		}
+		separate = now() - start;
+
+		start = now();
+		for (it = 0; it < ITERATIONS; it++) {
+			if (run_fused(in, out, sizes[s], &crc_fused)) {
+				ret = EXIT_FAILURE;
+				goto out;
+			}
+		}
+		fused = now() - start;
+
+		printf("%8zuKB %14.1f %14.1f %9.2fx %10s\n", sizes[s] >> 10,
+			   sizes[s] * ITERATIONS / separate / (1 << 20),
+			   sizes[s] * ITERATIONS / fused / (1 << 20), separate / fused,
+			   crc_separate == crc_fused ? "match" : "MISMATCH");
+
+		if (crc_separate != crc_fused) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+out:
+	free(in);
+	free(out);
+	return ret;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file reverse_ioctl.h
+ * 
+ * /dev/reverseのioctlコマンドを定義する. ユーザプログラムからもインクルードできる
+ */
+#ifndef REVERSE_IOCTL_H
+#define REVERSE_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * @def ioctlコマンドを識別するためのマジックナンバー
+ */
+#define REVERSE_IOC_MAGIC 'r'
+
+/**
+ * @enum 反転のモード
+ */
+enum {
+	//! 書き込まれたデータ全体を1つの文字列として反転させる(初期値)
+	REVERSE_MODE_WHOLE,
+	//! 改行で区切られたレコードごとに反転させる. 改行の位置はそのまま残す
+	REVERSE_MODE_NEWLINE,
+	//! 4バイトの長さ(ホストのバイトオーダー)が先頭に付いたレコードごとに反転させる. 長さはそのまま残す
+	REVERSE_MODE_LENGTH,
+	//! UTF-8の文字(コードポイント)単位で反転させる. 正しくないUTF-8ならread()が-EILSEQを返す
+	REVERSE_MODE_UTF8,
+	//! モードの数
+	REVERSE_MODE_MAX,
+};
+
+/**
+ * @def 反転のモードを設定する. argにREVERSE_MODE_*の値を直接渡す
+ * 
+ * ユーザ空間のメモリは読まないので, 方向のビットを持たない_IOで定義する
+ */
+#define REVERSE_IOC_SET_MODE _IO(REVERSE_IOC_MAGIC, 0)
+
+/**
+ * @def 現在の反転のモードを取得する. argはintへのポインタ
+ */
+#define REVERSE_IOC_GET_MODE _IOR(REVERSE_IOC_MAGIC, 1, int)
+
+/**
+ * @struct reverse_range
+ * @brief REVERSE_IOC_RANGEで反転させる範囲. mmap()したバッファの先頭からのオフセットで指定する
+ */
+struct reverse_range {
+	__u64 offset;
+	__u64 len;
+};
+
+/**
+ * @def mmap()したバッファの一部をその場で反転させる. argはstruct reverse_rangeへのポインタ
+ * 
+ * データのコピーは一切発生しない. mmap()していないセッションでは-EINVALを返す
+ */
+#define REVERSE_IOC_RANGE _IOW(REVERSE_IOC_MAGIC, 2, struct reverse_range)
+
+/**
+ * @enum 変換の連鎖を構成する処理
+ */
+enum {
+	//! 反転のモードに従って反転させる. 偶数回並べると反転しない
+	REVERSE_OP_REVERSE,
+	//! ASCIIの英大文字を小文字にする
+	REVERSE_OP_LOWER,
+	//! ASCIIの英小文字を大文字にする
+	REVERSE_OP_UPPER,
+	//! ASCIIの英字をROT13で置き換える
+	REVERSE_OP_ROT13,
+	//! 変換後のデータのCRC32Cを計算する. 連鎖の最後にだけ置ける
+	REVERSE_OP_CRC32C,
+	//! 処理の数
+	REVERSE_OP_MAX,
+};
+
+/**
+ * @def 1つの連鎖に並べられる処理の最大数
+ */
+#define REVERSE_CHAIN_MAX 8
+
+/**
+ * @struct reverse_chain
+ * @brief REVERSE_IOC_SET_CHAINで設定する変換の連鎖. ops[0]からops[nr_ops - 1]の順に適用する
+ */
+struct reverse_chain {
+	__u32 nr_ops;
+	__u32 ops[REVERSE_CHAIN_MAX];
+};
+
+/**
+ * @def 次のメッセージから適用する変換の連鎖を設定する. argはstruct reverse_chainへのポインタ
+ * 
+ * 連鎖全体はバッファの1回の走査で適用する. nr_opsが0なら反転だけの初期状態に戻す
+ */
+#define REVERSE_IOC_SET_CHAIN _IOW(REVERSE_IOC_MAGIC, 3, struct reverse_chain)
+
+/**
+ * @def 変換後のメッセージのCRC32Cを取得する. argは__u32へのポインタ
+ * 
+ * 連鎖の最後がREVERSE_OP_CRC32Cでなければ-EINVALを返す
+ */
+#define REVERSE_IOC_GET_CRC32C _IOR(REVERSE_IOC_MAGIC, 4, __u32)
+
+#endif /* REVERSE_IOCTL_H */
\ No newline at end of file
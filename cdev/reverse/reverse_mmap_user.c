@@ -0,0 +1,65 @@
+/**
+ * @file reverse_mmap_user.c
+ *
+ * /dev/reverseのバッファをmmap()し, REVERSE_IOC_RANGEでその場で反転させる
+ * データの書き込みも読み出しもマッピングを通して行うので, コピーは発生しない
+ *
+ * 使用例 -- sudo ./reverse_mmap_user "hello, world"
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "reverse_ioctl.h"
+
+#define DEVICE_PATH "/dev/reverse"
+#define MAP_SIZE 4096
+
+int main(int argc, char *argv[]) {
+	const char *message = argc > 1 ? argv[1] : "Hello from user space!";
+	struct reverse_range range;
+	char *mapped_mem;
+	int fd;
+
+	if (strlen(message) >= MAP_SIZE) {
+		printf("message must be shorter than %d bytes\n", MAP_SIZE);
+		return -1;
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	/* セッションのバッファをマッピング */
+	mapped_mem = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped_mem == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+
+	/* マッピングに直接書き込む */
+	strcpy(mapped_mem, message);
+
+	/* 書き込んだ範囲をその場で反転させる */
+	range.offset = 0;
+	range.len = strlen(message);
+	if (ioctl(fd, REVERSE_IOC_RANGE, &range) < 0) {
+		perror("ioctl");
+		munmap(mapped_mem, MAP_SIZE);
+		close(fd);
+		return -1;
+	}
+
+	printf("Reversed in place: %s\n", mapped_mem);
+
+	munmap(mapped_mem, MAP_SIZE);
+	close(fd);
+	return 0;
+}
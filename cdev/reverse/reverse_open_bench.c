@@ -0,0 +1,178 @@
+/**
+ * @file reverse_open_bench.c
+ *
+ * 短命なワーカーを想定して, /dev/reverseに対してopen -> write -> read -> closeを繰り返し,
+ * 1秒あたりのオープン回数を計測する
+ * スレッド数を1から全コアまで増やしていき, セッションごとの反転が並列に動くかを確認する
+ * 続けて, 1つのファイルディスクリプタでwrite -> readを繰り返した場合のメッセージ数も計測する
+ * どちらも読み込んだ内容が反転したメッセージと一致するかを確かめる
+ *
+ * 使用例 -- sudo ./reverse_open_bench [秒数] [最大スレッド数]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/reverse"
+#define MESSAGE "hello, reverse\n"
+#define REVERSED "\nesrever ,olleh"
+
+//! 計測を止めるためのフラグ
+static atomic_int stop;
+
+//! trueなら1つのファイルディスクリプタで複数のメッセージを書き込み, 読み込む
+static int reuse_fd;
+
+/**
+ * @struct bench_thread
+ * @brief スレッドごとの計測結果. false sharingを避けるためキャッシュライン単位で配置する
+ */
+struct bench_thread {
+	pthread_t tid;
+	int cpu;
+	unsigned long ops;
+	unsigned long busy;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief 1つのメッセージを書き込み, 反転したものが読み込めれば0を返す
+ */
+static int round_trip(int fd) {
+	char buffer[sizeof(MESSAGE)];
+
+	if (write(fd, MESSAGE, strlen(MESSAGE)) != (ssize_t)strlen(MESSAGE) ||
+		read(fd, buffer, sizeof(buffer)) != (ssize_t)strlen(MESSAGE) ||
+		memcmp(buffer, REVERSED, strlen(REVERSED)) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief 指定したCPUに固定して, open/write/read/closeを繰り返す
+ * reuse_fdなら, 1回だけopenしてwrite/readを繰り返す
+ */
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = arg;
+	cpu_set_t set;
+	int fd = -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (fd < 0) {
+			fd = open(DEVICE_PATH, O_RDWR);
+		}
+
+		if (fd < 0) {
+			if (errno == EBUSY) {
+				t->busy++;
+			} else {
+				t->errors++;
+			}
+			continue;
+		}
+
+		if (round_trip(fd)) {
+			t->errors++;
+		} else {
+			t->ops++;
+		}
+
+		if (!reuse_fd) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief nthreads個のスレッドで計測し, 結果を表示する
+ */
+static int run(int nthreads, int seconds) {
+	struct bench_thread *threads;
+	struct timespec start, end;
+	unsigned long ops = 0, busy = 0, errors = 0;
+	double elapsed;
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	threads = aligned_alloc(64, sizeof(*threads) * nthreads);
+	if (!threads) {
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	atomic_store(&stop, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = (struct bench_thread){ .cpu = i % ncpus };
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		busy += threads[i].busy;
+		errors += threads[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%8d %16.0f %16.0f %10lu %10lu\n", nthreads, ops / elapsed,
+		   ops / elapsed / nthreads, busy, errors);
+
+	free(threads);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int n;
+
+	if (seconds <= 0 || max_threads <= 0) {
+		printf("Usage: %s [seconds] [max threads]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (reuse_fd = 0; reuse_fd <= 1; reuse_fd++) {
+		printf("%8s %16s %16s %10s %10s\n", "threads", reuse_fd ? "messages/s" : "opens/s",
+			   reuse_fd ? "messages/s/thread" : "opens/s/thread", "EBUSY", "errors");
+
+		/* 1, 2, 4, ...と倍にしていき, 最後に最大スレッド数で計測する */
+		for (n = 1; n < max_threads; n *= 2) {
+			if (run(n, seconds)) {
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (run(max_threads, seconds)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file reverse_parallel_bench.c
+ *
+ * /dev/reverseの並列反転が, CPU数に対してどのようにスケールするかを計測する
+ * max_workersを1からCPU数まで変えながら, 大きなバッファの反転速度と1CPUに対する速度向上率を表示する
+ * 書き込んだ直後に1バイトだけ読み込む時間を反転にかかった時間とみなす
+ *
+ * 使用例 -- sudo ./reverse_parallel_bench [最大CPU数]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/reverse"
+#define PARAM_DIR "/sys/module/reverse/parameters/"
+
+//! 1つの条件あたりの繰り返し回数
+#define ITERATIONS 8
+
+static const size_t sizes[] = { 1UL << 20, 16UL << 20, 64UL << 20 };
+
+/**
+ * @brief モジュールパラメータを書き換える
+ */
+static int set_param(const char *name, unsigned long value) {
+	char path[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), PARAM_DIR "%s", name);
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "%lu\n", value);
+	fclose(fp);
+	return 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief sizeバイトを書き込み, 最初の1バイトの読み込みにかかった時間を返す
+ */
+static double reverse_once(const char *data, size_t size) {
+	double start, elapsed;
+	size_t done = 0;
+	ssize_t n;
+	char c;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	while (done < size) {
+		n = write(fd, data + done, size - done);
+		if (n <= 0) {
+			perror("write");
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	start = now();
+	n = read(fd, &c, 1);
+	elapsed = now() - start;
+
+	close(fd);
+
+	if (n != 1) {
+		perror("read");
+		return -1;
+	}
+
+	return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	int max_cpus = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	double base[sizeof(sizes) / sizeof(sizes[0])];
+	unsigned int s;
+	char *data;
+	size_t i;
+	int cpus, ret = EXIT_SUCCESS;
+
+	if (max_cpus <= 0) {
+		printf("Usage: %s [max cpus]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	data = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (!data) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; i++) {
+		data[i] = 'a' + i % 26;
+	}
+
+	/* 計測するサイズは全て並列化の対象にする */
+	if (set_param("parallel_threshold", sizes[0])) {
+		free(data);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%6s %12s %12s %10s\n", "cpus", "size", "GB/s", "speedup");
+
+	/* 1, 2, 4, ...と倍にしていき, 最後に最大CPU数で計測する */
+	for (cpus = 1; ; cpus *= 2) {
+		if (cpus > max_cpus) {
+			cpus = max_cpus;
+		}
+
+		if (set_param("max_workers", cpus)) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			double total = 0, t;
+			int it;
+
+			for (it = 0; it < ITERATIONS; it++) {
+				t = reverse_once(data, sizes[s]);
+				if (t < 0) {
+					ret = EXIT_FAILURE;
+					goto out;
+				}
+				total += t;
+			}
+
+			if (cpus == 1) {
+				base[s] = total;
+			}
+
+			printf("%6d %10zuMB %12.3f %9.2fx\n", cpus, sizes[s] >> 20,
+				   sizes[s] * ITERATIONS / total / 1e9, base[s] / total);
+		}
+
+		if (cpus == max_cpus) {
+			break;
+		}
+	}
+
+out:
+	/* 自動で決めた閾値と全CPUの使用に戻す */
+	set_param("parallel_threshold", 0);
+	set_param("max_workers", 0);
+
+	free(data);
+	return ret;
+}
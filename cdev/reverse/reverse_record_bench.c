@@ -0,0 +1,132 @@
+/**
+ * @file reverse_record_bench.c
+ *
+ * /dev/reverseのレコードモードで, 1回のwrite()とread()でまとめて反転させるレコード数を
+ * 1, 64, 4096と変えたときの1秒あたりのレコード数を計測する
+ *
+ * 使用例 -- sudo ./reverse_record_bench [レコードの長さ]
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reverse_ioctl.h"
+
+#define DEVICE_PATH "/dev/reverse"
+
+//! 1つの条件あたりの計測時間(秒)
+#define BENCH_SECONDS 2.0
+
+static const int batch_sizes[] = { 1, 64, 4096 };
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief batch個のレコードをmodeの形式でbufferに並べ, その長さを返す
+ */
+static size_t build_batch(char *buffer, int mode, int batch, size_t record_len) {
+	size_t pos = 0;
+	uint32_t len = record_len;
+	int i;
+
+	for (i = 0; i < batch; i++) {
+		if (mode == REVERSE_MODE_LENGTH) {
+			memcpy(buffer + pos, &len, sizeof(len));
+			pos += sizeof(len);
+		}
+
+		memset(buffer + pos, 'a' + i % 26, record_len);
+		pos += record_len;
+
+		if (mode == REVERSE_MODE_NEWLINE) {
+			buffer[pos++] = '\n';
+		}
+	}
+
+	return pos;
+}
+
+/**
+ * @brief 1回のwrite()とpread()でbatch個のレコードを反転させることを繰り返す
+ */
+static int run(int fd, const char *label, int mode, int batch, size_t record_len) {
+	size_t size = batch * (record_len + sizeof(uint32_t) + 1);
+	char *in = malloc(size), *out = malloc(size);
+	unsigned long records = 0;
+	double start, elapsed;
+	int ret = -1;
+
+	if (!in || !out) {
+		perror("malloc");
+		goto out;
+	}
+
+	if (ioctl(fd, REVERSE_IOC_SET_MODE, mode) < 0) {
+		perror("ioctl");
+		goto out;
+	}
+
+	size = build_batch(in, mode, batch, record_len);
+
+	start = now();
+	do {
+		/* 読み込み後の書き込みは新しいバッチとして扱われる */
+		if (write(fd, in, size) != (ssize_t)size ||
+			pread(fd, out, size, 0) != (ssize_t)size) {
+			perror("write/read");
+			goto out;
+		}
+
+		records += batch;
+		elapsed = now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	printf("%-8s %8d %16.0f records/s %10.1f MB/s\n", label, batch,
+		   records / elapsed, records * record_len / elapsed / (1 << 20));
+	ret = 0;
+out:
+	free(in);
+	free(out);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	size_t record_len = argc > 1 ? strtoul(argv[1], NULL, 0) : 32;
+	unsigned int i;
+	int fd, ret = 0;
+
+	if (record_len == 0) {
+		printf("Usage: %s [record length]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("record length: %zu bytes\n", record_len);
+	printf("%-8s %8s\n", "mode", "batch");
+
+	for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+		ret |= run(fd, "newline", REVERSE_MODE_NEWLINE, batch_sizes[i], record_len);
+	}
+
+	for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+		ret |= run(fd, "length", REVERSE_MODE_LENGTH, batch_sizes[i], record_len);
+	}
+
+	close(fd);
+	return ret ? EXIT_FAILURE : 0;
+}
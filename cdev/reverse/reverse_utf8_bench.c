@@ -0,0 +1,151 @@
+/**
+ * @file reverse_utf8_bench.c
+ *
+ * /dev/reverseのバイト単位の反転(REVERSE_MODE_WHOLE)とUTF-8のコードポイント単位の反転
+ * (REVERSE_MODE_UTF8)の速度を, ASCIIのみのテキストと日本語のテキストで比較する
+ * 書き込んだ直後に1バイトだけ読み込む時間を反転(と検証)にかかった時間とみなす
+ *
+ * 使用例 -- sudo ./reverse_utf8_bench
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reverse_ioctl.h"
+
+#define DEVICE_PATH "/dev/reverse"
+
+//! 1つの条件あたりの繰り返し回数
+#define ITERATIONS 16
+
+//! 日本語テキストの素材. 1文字3バイトの文字と改行が混ざる
+#define JAPANESE_TEXT "吾輩は猫である。名前はまだ無い。\n"
+
+static const size_t sizes[] = { 1UL << 20, 16UL << 20 };
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief modeでsizeバイトを書き込み, 最初の1バイトの読み込みにかかった時間を返す
+ */
+static double reverse_once(int mode, const char *data, size_t size) {
+	double start, elapsed;
+	size_t done = 0;
+	ssize_t n;
+	char c;
+	int fd;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (ioctl(fd, REVERSE_IOC_SET_MODE, mode) < 0) {
+		perror("ioctl");
+		close(fd);
+		return -1;
+	}
+
+	while (done < size) {
+		n = write(fd, data + done, size - done);
+		if (n <= 0) {
+			perror("write");
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	start = now();
+	n = read(fd, &c, 1);
+	elapsed = now() - start;
+
+	close(fd);
+
+	if (n != 1) {
+		perror("read");
+		return -1;
+	}
+
+	return elapsed;
+}
+
+/**
+ * @brief 文字の途中で切れないように, patternを繰り返してsizeバイト以内のテキストを作り, その長さを返す
+ */
+static size_t fill_text(char *data, size_t size, const char *pattern) {
+	size_t len = strlen(pattern), pos = 0;
+
+	while (pos + len <= size) {
+		memcpy(data + pos, pattern, len);
+		pos += len;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief 全てのサイズについてバイトモードとUTF-8モードを計測し, GB/sを表示する
+ */
+static int run(const char *label, const char *pattern, char *data) {
+	unsigned int s;
+	int i, it;
+
+	static const struct {
+		const char *name;
+		int mode;
+	} modes[] = {
+		{ "byte", REVERSE_MODE_WHOLE },
+		{ "utf8", REVERSE_MODE_UTF8 },
+	};
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t size = fill_text(data, sizes[s], pattern);
+
+		for (i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); i++) {
+			double total = 0, t;
+
+			for (it = 0; it < ITERATIONS; it++) {
+				t = reverse_once(modes[i].mode, data, size);
+				if (t < 0) {
+					return -1;
+				}
+				total += t;
+			}
+
+			printf("%-10s %-6s %8zuMB %10.3f GB/s\n", label, modes[i].name,
+				   sizes[s] >> 20, size * ITERATIONS / total / 1e9);
+		}
+	}
+
+	return 0;
+}
+
+int main(void) {
+	char *data;
+	int ret = 0;
+
+	data = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (!data) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-10s %-6s %10s %15s\n", "text", "mode", "size", "throughput");
+
+	ret |= run("ascii", "The quick brown fox jumps over the lazy dog.\n", data);
+	ret |= run("japanese", JAPANESE_TEXT, data);
+
+	free(data);
+	return ret ? EXIT_FAILURE : 0;
+}
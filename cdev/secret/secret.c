@@ -8,12 +8,15 @@
 //! 割り当てられるメジャー番号
 int major;
 
-//! データを受け取るバッファ
-char dev_buffer[MAX_BUFFER_SIZE];
+//! データを受け取るページ. splice()でパイプにそのまま渡す
+struct page *dev_page;
 
 //! バッファのサイズ
 size_t buffer_size = 0;
 
+//! dev_pageとbuffer_sizeを保護する
+static DEFINE_MUTEX(buffer_lock);
+
 //! デバイスへの複数アクセスを防ぐための状態を持つ
 static atomic_t already_open = ATOMIC_INIT(CDEV_NOT_USED);
 
@@ -44,48 +47,146 @@ static int device_release(struct inode *inode, struct file *file) {
 	return 0;
 }
 
+/**
+ * @brief 保持しているページを取り出し, バッファを空にする. buffer_lockを取得して呼び出す
+ */
+static struct page *take_buffer(size_t *size) {
+	struct page *page = dev_page;
+
+	*size = buffer_size;
+	dev_page = NULL;
+	buffer_size = 0;
+
+	return page;
+}
+
 /**
  * @brief read()が呼び出されたときの処理
  */
 static ssize_t device_read(struct file *file, char __user *buffer,
 						   size_t length, loff_t *offset)
 {
+	struct page *page;
+	size_t size;
+
+	mutex_lock(&buffer_lock);
 	if (*offset || buffer_size == 0) {
+		mutex_unlock(&buffer_lock);
 		pr_debug("dev read: END\n");
 		*offset = 0;
 		return 0;
 	}
-	
-	size_t read_buffer_size = min(buffer_size, length);
-	if (copy_to_user(buffer, dev_buffer, read_buffer_size)) {
+
+	/* 1回だけ読み出せるように, カーネル空間のバッファを空にする */
+	page = take_buffer(&size);
+	mutex_unlock(&buffer_lock);
+
+	size_t read_buffer_size = min(size, length);
+	if (copy_to_user(buffer, page_address(page), read_buffer_size)) {
+		put_page(page);
 		return -EFAULT;
 	}
 	*offset += read_buffer_size;
+	put_page(page);
 
 	pr_debug("read %lu bytes\n", read_buffer_size);
 
-	/* カーネル空間のバッファを空にする */
-	snprintf(dev_buffer, buffer_size, "");
-	buffer_size = 0;
-
 	return read_buffer_size;
 }
 
+/**
+ * @brief splice_to_pipe()がパイプに渡せなかったページの参照を解放する
+ */
+static void device_spd_release(struct splice_pipe_desc *spd, unsigned int i) {
+	put_page(spd->pages[i]);
+}
+
+/**
+ * @brief splice()やsendfile()でデバイスからパイプへ読み込むときの処理
+ * 
+ * 保持しているページの参照をそのままパイプに移すので, データのコピーは発生しない
+ * パイプが一杯で渡せなかったときにデータを失わないように, 渡せたときだけバッファを空にする
+ */
+static ssize_t device_splice_read(struct file *file, loff_t *ppos,
+								  struct pipe_inode_info *pipe, size_t len,
+								  unsigned int flags)
+{
+	struct page *pages[1];
+	struct partial_page partial[1];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages = 1,
+		.nr_pages_max = 1,
+		.ops = &nosteal_pipe_buf_ops,
+		.spd_release = device_spd_release,
+	};
+	struct page *page;
+	size_t size;
+	ssize_t ret;
+
+	mutex_lock(&buffer_lock);
+	if (*ppos || buffer_size == 0) {
+		mutex_unlock(&buffer_lock);
+		*ppos = 0;
+		return 0;
+	}
+
+	/* パイプに渡す参照. 渡せなければdevice_spd_release()で解放される */
+	get_page(dev_page);
+	pages[0] = dev_page;
+	partial[0].offset = 0;
+	partial[0].len = min(buffer_size, len);
+
+	/* splice_to_pipe()は待たずに戻るので, buffer_lockを持ったまま呼び出して書き込みと競合しないようにする */
+	ret = splice_to_pipe(pipe, &spd);
+	if (ret > 0) {
+		/* 1回だけ読み出せるように, カーネル空間のバッファを空にする */
+		page = take_buffer(&size);
+		put_page(page);
+		*ppos += ret;
+	}
+	mutex_unlock(&buffer_lock);
+
+	pr_debug("splice %zd bytes\n", ret);
+
+	return ret;
+}
+
 /**
  * @brief write()が呼び出されたときの処理
+ * 
+ * write_iterで実装しているので, splice()でパイプから書き込むこともできる
  */
-static ssize_t device_write(struct file *file, const char __user *buffer,
-							size_t length, loff_t *offset)
+static ssize_t device_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	buffer_size = min(MAX_BUFFER_SIZE, length);
+	size_t size = min(MAX_BUFFER_SIZE, iov_iter_count(from));
+	struct page *page, *old_page;
 
-	if (copy_from_user(dev_buffer, buffer, buffer_size)) {
+	/* パイプが古いページを参照している可能性があるので, 書き込みのたびに新しいページを使う */
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		return -ENOMEM;
+	}
+
+	if (copy_from_iter(page_address(page), size, from) != size) {
+		put_page(page);
 		return -EFAULT;
 	}
-	*offset += buffer_size;
+	iocb->ki_pos += size;
+
+	mutex_lock(&buffer_lock);
+	old_page = dev_page;
+	dev_page = page;
+	buffer_size = size;
+	mutex_unlock(&buffer_lock);
 
-	pr_debug("write %lu bytes\n", buffer_size);
-	return buffer_size;
+	if (old_page) {
+		put_page(old_page);
+	}
+
+	pr_debug("write %lu bytes\n", size);
+	return size;
 }
 
 /**
@@ -96,7 +197,9 @@ struct file_operations cdev_fops = {
 	.open = device_open,
 	.release = device_release,
 	.read = device_read,
-	.write = device_write,
+	.write_iter = device_write_iter,
+	.splice_read = device_splice_read,
+	.splice_write = iter_file_splice_write,
 };
 
 /**
@@ -133,6 +236,10 @@ static void __exit chardev_exit(void) {
 	class_destroy(cls);
 
 	unregister_chrdev(major, DEVICE_NAME);
+
+	if (dev_page) {
+		put_page(dev_page);
+	}
 }
 
 module_init(chardev_init);
@@ -12,10 +12,15 @@
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 #include <linux/types.h>
 #include <linux/timekeeping.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
 #include <linux/minmax.h>
@@ -29,7 +34,7 @@
 /**
  * @def デバイスが保持できるデータの最大サイズ
  */
-#define MAX_BUFFER_SIZE 80
+#define MAX_BUFFER_SIZE 80UL
 
 /**
  * @enum デバイスへの複数アクセスを防ぐための列挙体
@@ -42,8 +47,8 @@ enum {
 //! 割り当てられるメジャー番号
 extern int major;
 
-//! データを受け取るバッファ
-extern char dev_buffer[MAX_BUFFER_SIZE];
+//! データを受け取るページ
+extern struct page *dev_page;
 
 //! バッファのサイズ
 extern size_t buffer_size;